@@ -0,0 +1,29 @@
+/* Overflow-checked array allocation shared by flt_val_sort and uniq_str.
+ *
+ * alloc_array(count, size) fails loudly instead of letting count * size
+ * wrap around or returning NULL, so callers can size scratch buffers for
+ * billions of elements without checking every multiplication.
+ */
+
+#ifndef _ALLOC_H
+#define _ALLOC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+static void *alloc_array(size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        fprintf(stderr, "Error: allocation of %zu x %zu bytes overflows!\n", count, size);
+        exit(2);
+    }
+    size_t bytes = count * size;
+    void *p = malloc(bytes > 0 ? bytes : 1);
+    if (p == NULL) {
+        fprintf(stderr, "Error: out of memory allocating %zu bytes!\n", bytes);
+        exit(2);
+    }
+    return p;
+}
+
+#endif /* _ALLOC_H */
@@ -0,0 +1,205 @@
+/* Arena (bump) allocator for sort scratch and per-iteration data.
+ *
+ * An arena hands out memory from large mmap'ed chunks by bumping a pointer;
+ * nothing is freed individually.  Instead a caller saves a mark, allocates
+ * freely, and releases back to the mark, or resets the whole arena:
+ *
+ *  arena *scratch = arena_local();
+ *  arena_mark m = arena_save(scratch);
+ *  float *tmp = (float *) arena_alloc_array(scratch, n, sizeof(float));
+ *  ...
+ *  arena_release(scratch, m);
+ *
+ * Released chunks are kept for reuse, so once an arena has grown to the
+ * size a benchmark iteration needs, later iterations make no system calls.
+ * When one iteration spilled into several chunks, arena_reset() replaces
+ * them with a single chunk of the peak size.  Chunks are mapped with huge
+ * pages when they are large enough (hugepage.h) and placed by the NUMA
+ * policy (numa_place.h).
+ *
+ * arena_local() returns the calling thread's arena (one per OpenMP thread
+ * number), so threads never share an arena and need no locking.
+ * arena_maps counts the chunks mapped by all threads, so a caller can check
+ * that a stretch of code allocated nothing new.  In C++17
+ * an arena_resource makes an arena usable by std::pmr containers.
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "numa_place.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef ARENA_CHUNK_MIN
+#define ARENA_CHUNK_MIN     (1 << 20)
+#endif
+
+#define ARENA_ALIGN         64      /* arrays start on a cache line */
+#define ARENA_MAX_THREADS   256
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;                /* bytes including this header */
+    char pad[ARENA_ALIGN - sizeof(void *) - sizeof(size_t)];
+} arena_chunk;
+
+typedef struct {
+    arena_chunk *head;          /* first chunk, NULL before the first allocation */
+    arena_chunk *cur;           /* chunk being bumped */
+    size_t used;                /* bytes used in cur, including its header */
+    size_t live;                /* bytes handed out since the last reset */
+    size_t peak;                /* largest live since the last reset */
+    char pad[64 - 2 * sizeof(void *) - 3 * sizeof(size_t)];
+} arena;
+
+typedef struct {
+    arena_chunk *chunk;
+    size_t used;
+    size_t live;
+} arena_mark;
+
+static arena arena_threads[ARENA_MAX_THREADS];
+
+/* chunks mapped so far, by all threads */
+static int64_t arena_maps = 0;
+
+static arena_chunk *arena_map_chunk(size_t size) {
+    size_t len;
+    void *p = huge_map(size, &len);
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+    arena_maps++;
+    numa_place(p, len);
+    arena_chunk *c = (arena_chunk *) p;
+    c->next = NULL;
+    c->size = len;
+    return c;
+}
+
+/* unmaps c and every chunk after it */
+static void arena_unmap_from(arena_chunk *c) {
+    while (c != NULL) {
+        arena_chunk *next = c->next;
+        huge_unmap(c, c->size);
+        c = next;
+    }
+}
+
+/* align must be a power of two */
+static void *arena_alloc(arena *a, size_t bytes, size_t align) {
+    size_t start = (a->used + align - 1) & ~(align - 1);
+    if (a->cur == NULL || bytes > a->cur->size || start > a->cur->size - bytes) {
+        /* move on to the next chunk, replacing it if it is too small */
+        size_t need = bytes + ((sizeof(arena_chunk) + align - 1) & ~(align - 1));
+        arena_chunk *next = (a->cur != NULL) ? a->cur->next : a->head;
+        if (next == NULL || next->size < need) {
+            size_t size = (a->cur != NULL) ? 2 * a->cur->size : ARENA_CHUNK_MIN;
+            if (size < need)
+                size = need;
+            arena_chunk *c = arena_map_chunk(size);
+            if (next != NULL) {
+                c->next = next->next;
+                next->next = NULL;
+                arena_unmap_from(next);
+            }
+            if (a->cur != NULL)
+                a->cur->next = c;
+            else
+                a->head = c;
+            next = c;
+        }
+        a->cur = next;
+        start = (sizeof(arena_chunk) + align - 1) & ~(align - 1);
+    }
+    a->used = start + bytes;
+    a->live += bytes + align - 1;
+    if (a->live > a->peak)
+        a->peak = a->live;
+    return (char *) a->cur + start;
+}
+
+static void *arena_alloc_array(arena *a, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        fprintf(stderr, "Error: allocation of %zu x %zu bytes overflows!\n", count, size);
+        exit(2);
+    }
+    return arena_alloc(a, count * size, ARENA_ALIGN);
+}
+
+static arena_mark arena_save(const arena *a) {
+    arena_mark m;
+    m.chunk = a->cur;
+    m.used = a->used;
+    m.live = a->live;
+    return m;
+}
+
+/* frees everything allocated after m; the chunks stay mapped */
+static void arena_release(arena *a, arena_mark m) {
+    a->cur = m.chunk;
+    a->used = m.used;
+    a->live = m.live;
+}
+
+/* frees everything; if the arena needed several chunks, they are replaced
+   by one large enough for the peak, so the next round bumps a single chunk */
+static void arena_reset(arena *a) {
+    if (a->head != NULL && a->head->next != NULL) {
+        size_t size = a->peak + sizeof(arena_chunk);
+        arena_unmap_from(a->head);
+        a->head = arena_map_chunk(size);
+    }
+    a->cur = NULL;
+    a->used = 0;
+    a->live = 0;
+    a->peak = 0;
+}
+
+static void arena_free(arena *a) {
+    arena_unmap_from(a->head);
+    a->head = NULL;
+    a->cur = NULL;
+    a->used = 0;
+    a->live = 0;
+    a->peak = 0;
+}
+
+static inline arena *arena_local(void) {
+#ifdef _OPENMP
+    int tid = omp_get_thread_num();
+    if (tid >= ARENA_MAX_THREADS)
+        tid = ARENA_MAX_THREADS - 1;
+    return &arena_threads[tid];
+#else
+    return &arena_threads[0];
+#endif
+}
+
+#if defined(__cplusplus) && __cplusplus >= 201703L
+#include <memory_resource>
+
+/* std::pmr adapter: deallocation is a no-op, memory returns on release/reset */
+class arena_resource : public std::pmr::memory_resource {
+    public:
+        explicit arena_resource(arena *a) : a(a) {}
+    private:
+        void *do_allocate(size_t bytes, size_t align) override {
+            return arena_alloc(a, bytes, align);
+        }
+        void do_deallocate(void *, size_t, size_t) override {
+        }
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+            return this == &other;
+        }
+        arena *a;
+};
+#endif
+
+#endif /* _ARENA_H */
@@ -0,0 +1,118 @@
+/* Benchmark support shared by flt_val_sort and uniq_str.
+ *
+ * timer() reads CLOCK_MONOTONIC, so the measurements are not disturbed by
+ * NTP or manual clock changes.  bench_report() summarises the per-iteration
+ * times of one benchmark (min / median / p95 / mean) on stderr and, when a
+ * machine readable format was requested with -f, prints one CSV row or one
+ * JSON object per benchmark on stdout.
+ *
+ * The CSV columns are:
+ *  program,alg,input,n,bytes,iterations,warmup,min_ms,median_ms,p95_ms,mean_ms,MBps,pages
+ * where MBps is computed from the median time and pages is the page size
+ * backing the input array (see huge_page_desc() in hugepage.h).
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_FORMAT_NONE 0
+#define BENCH_FORMAT_CSV  1
+#define BENCH_FORMAT_JSON 2
+
+typedef struct {
+    const char *program;
+    const char *input;      /* input file or input type */
+    int num_warmup;         /* untimed runs before the timed iterations */
+    int format;
+    const char *pages;      /* page size backing the input */
+} bench_config;
+
+static bench_config bench_cfg = { "", "", 1, BENCH_FORMAT_NONE, "4k" };
+
+/* median time (s) of the last bench_report(), for the tuning runs */
+static double bench_last_median = 0.0;
+
+static double timer(void) {
+
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return ((double) (tp.tv_sec) + 1e-9 * tp.tv_nsec);
+}
+
+static int bench_parse_format(const char *s) {
+    if (strcmp(s, "csv") == 0)
+        return BENCH_FORMAT_CSV;
+    if (strcmp(s, "json") == 0)
+        return BENCH_FORMAT_JSON;
+    return BENCH_FORMAT_NONE;
+}
+
+static int bench_cmpf(const void *u, const void *v) {
+    double a = *(const double *) u;
+    double b = *(const double *) v;
+    return (a > b) - (a < b);
+}
+
+/* nearest-rank percentile of sorted times, p in [0, 100] */
+static double bench_percentile(const double *sorted, int n, double p) {
+    int rank = (int) (p / 100.0 * n + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > n)
+        rank = n;
+    return sorted[rank - 1];
+}
+
+/* times are in seconds; bytes is the amount of data one iteration processes */
+static void bench_report(const char *alg, long long n, double bytes,
+        const double *times, int num_times) {
+
+    if (num_times <= 0)
+        return;
+
+    double *sorted = (double *) malloc(num_times * sizeof(double));
+    if (sorted == NULL)
+        return;
+    memcpy(sorted, times, num_times * sizeof(double));
+    qsort(sorted, num_times, sizeof(double), bench_cmpf);
+
+    double mean = 0.0;
+    int i;
+    for (i=0; i<num_times; i++)
+        mean += sorted[i];
+    mean /= num_times;
+
+    double t_min = sorted[0];
+    double t_median = (num_times % 2) ? sorted[num_times/2]
+        : 0.5 * (sorted[num_times/2 - 1] + sorted[num_times/2]);
+    double t_p95 = bench_percentile(sorted, num_times, 95.0);
+    double rate = bytes / (t_median * 1e6);
+    free(sorted);
+    bench_last_median = t_median;
+
+    fprintf(stderr, "Min / median / p95 time: %9.3lf %9.3lf %9.3lf ms.\n",
+            t_min*1e3, t_median*1e3, t_p95*1e3);
+
+    if (bench_cfg.format == BENCH_FORMAT_CSV) {
+        printf("%s,%s,%s,%lld,%.0lf,%d,%d,%.6lf,%.6lf,%.6lf,%.6lf,%.3lf,%s\n",
+                bench_cfg.program, alg, bench_cfg.input, n, bytes,
+                num_times, bench_cfg.num_warmup,
+                t_min*1e3, t_median*1e3, t_p95*1e3, mean*1e3, rate, bench_cfg.pages);
+    } else if (bench_cfg.format == BENCH_FORMAT_JSON) {
+        printf("{\"program\": \"%s\", \"alg\": \"%s\", \"input\": \"%s\", "
+                "\"n\": %lld, \"bytes\": %.0lf, \"iterations\": %d, \"warmup\": %d, "
+                "\"min_ms\": %.6lf, \"median_ms\": %.6lf, \"p95_ms\": %.6lf, "
+                "\"mean_ms\": %.6lf, \"MBps\": %.3lf, \"pages\": \"%s\"}\n",
+                bench_cfg.program, alg, bench_cfg.input, n, bytes,
+                num_times, bench_cfg.num_warmup,
+                t_min*1e3, t_median*1e3, t_p95*1e3, mean*1e3, rate, bench_cfg.pages);
+    }
+    fflush(stdout);
+}
+
+#endif /* _BENCH_H */
@@ -0,0 +1,82 @@
+#!/bin/sh
+# Benchmark driver: builds both programs and sweeps
+#   flt_val_sort: alg_type x input_type x n
+#   uniq_str:     alg_type x every file in Q2input and a generated input of
+#                 every kind (-g zipf|iri|varlen, GEN_LINES lines)
+# Results are collected in bench_<commit>.csv (or .json with -f json), one
+# row per benchmark, so runs from different commits can be compared.
+#
+# usage: ./bench.sh [-f csv|json] [-i iterations] [-w warmup] [-n "n values"]
+
+FORMAT=csv
+ITERATIONS=10
+WARMUP=1
+SIZES="1000000 10000000"
+GEN_LINES=1000000
+
+while getopts "f:i:w:n:" opt; do
+    case $opt in
+        f) FORMAT=$OPTARG ;;
+        i) ITERATIONS=$OPTARG ;;
+        w) WARMUP=$OPTARG ;;
+        n) SIZES=$OPTARG ;;
+        *) echo "usage: $0 [-f csv|json] [-i iterations] [-w warmup] [-n \"n values\"]" >&2
+           exit 1 ;;
+    esac
+done
+
+cd "$(dirname "$0")" || exit 1
+
+CC=${CC:-gcc}
+CXX=${CXX:-g++}
+CFLAGS=${CFLAGS:--O3 -fopenmp}
+
+BUILD_DIR=$(mktemp -d)
+trap 'rm -rf "$BUILD_DIR"' EXIT
+
+$CC $CFLAGS flt_val_sort.c -o "$BUILD_DIR/flt_val_sort" || exit 1
+$CXX $CFLAGS uniq_str.cc -o "$BUILD_DIR/uniq_str" || exit 1
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+OUT=bench_$COMMIT.$FORMAT
+OPTS="-f $FORMAT -i $ITERATIONS -w $WARMUP"
+
+if [ "$FORMAT" = csv ]; then
+    echo "program,alg,input,n,bytes,iterations,warmup,min_ms,median_ms,p95_ms,mean_ms,MBps,pages" > "$OUT"
+else
+    : > "$OUT"
+fi
+
+for n in $SIZES; do
+    for input_type in 0 1 2 3 4 5 6 7 8 9; do
+        for alg_type in 0 1 5 6; do
+            "$BUILD_DIR/flt_val_sort" $OPTS "$n" $input_type $alg_type \
+                >> "$OUT" 2>/dev/null || echo "failed: flt_val_sort $n $input_type $alg_type" >&2
+        done
+        # key/value sorts in both layouts; inline qsort only sorts packed pairs
+        for alg_type in 2 3 4; do
+            for layout in packed split; do
+                [ $alg_type = 3 ] && [ $layout = split ] && continue
+                "$BUILD_DIR/flt_val_sort" $OPTS -l $layout "$n" $input_type $alg_type \
+                    >> "$OUT" 2>/dev/null || echo "failed: flt_val_sort -l $layout $n $input_type $alg_type" >&2
+            done
+        done
+    done
+done
+
+# generated inputs, written once by an untimed run
+for kind in zipf iri varlen; do
+    "$BUILD_DIR/uniq_str" -g $kind -i 1 -w 0 -V off "$BUILD_DIR/$kind" $GEN_LINES 1 \
+        > /dev/null 2>&1 || echo "failed: uniq_str -g $kind" >&2
+done
+
+# the stateful and multi-file modes (4, 7, 8) are not part of the sweep
+for file in Q2input/* "$BUILD_DIR/zipf" "$BUILD_DIR/iri" "$BUILD_DIR/varlen"; do
+    n=$(wc -l < "$file")
+    for alg_type in 0 1 2 3 5 6 9 10; do
+        "$BUILD_DIR/uniq_str" $OPTS "$file" $n $alg_type \
+            >> "$OUT" 2>/dev/null || echo "failed: uniq_str $file $alg_type" >&2
+    done
+done
+
+echo "results written to $OUT" >&2
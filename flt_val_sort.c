@@ -6,29 +6,26 @@
 #include <sys/time.h>
 #include <time.h>
 #include <string.h>
+#include <stdint.h>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
+#include <unistd.h>
 #include "qsort.h"
-
-void stephen_merge_sort(float * a, int n);  // header for my merge sort
-void print_arr(float * a, int n);           // header for printing the array
-
-static double timer() {
-    
-    struct timeval tp;
-    gettimeofday(&tp, NULL);
-    return ((double) (tp.tv_sec) + 1e-6 * tp.tv_usec);
-
-    /* The code below is for another high resolution timer */
-    /* I'm using gettimeofday because it's more portable */
-
-    /*
-    struct timespec tp;
-    clock_gettime(CLOCK_MONOTONIC, &tp);
-    return ((double) (tp.tv_sec) + 1e-9 * tp.tv_nsec);
-    */
-}
+#include "alloc.h"
+#include "numa_place.h"
+#include "arena.h"
+#include "sort_ctx.h"
+#include "pool.h"
+#include "msort.h"
+#include "bench.h"
+#include "perf_counters.h"
+#include "verify.h"
+#include "gen.h"
+#include "tune.h"
+
+void stephen_merge_sort(float * a, int64_t n);  // header for my merge sort
+void print_arr(float * a, int64_t n);           // header for printing the array
 
 /* comparison routine for C's qsort */
 static int qs_cmpf(const void *u, const void *v) {
@@ -41,52 +38,115 @@ static int qs_cmpf(const void *u, const void *v) {
         return 0;
 }
 
+/* maps a float to an unsigned integer with the same order; NaNs go to the
+   ends (IEEE totalOrder: -NaN < -inf < ... < -0 < +0 < ... < +inf < +NaN) */
+static inline uint32_t flt_radix_key(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u ^ ((u >> 31) ? 0xFFFFFFFFu : 0x80000000u);
+}
+
+/* all sorts order by flt_radix_key(), so inputs with NaNs sort too */
+#define flt_lt(a,b) (flt_radix_key(a) < flt_radix_key(b))
+
 /* inline QSORT() comparison routine */
-#define inline_qs_cmpf(a,b) ((*a)<(*b))
+#define inline_qs_cmpf(a,b) flt_lt(*(a), *(b))
 
+static inline uint64_t flt_bits(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
 
-static int inline_qsort_serial(const float *A, const int n, const int num_iterations) {
+/* order-independent checksum of the values in A, see verify.h */
+static uint64_t flt_checksum(const float *A, const int64_t n) {
+    uint64_t sum = 0;
+    int64_t i;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:sum)
+#endif
+    for (i=0; i<n; i++)
+        sum += verify_mix(flt_bits(A[i]));
+    return sum;
+}
 
-    fprintf(stderr, "N %d\n", n);
+/* checks that B is sorted and, in full mode, holds the input values */
+static void verify_sorted(const float *B, const int64_t n, const char *what) {
+    double t0 = verify_begin();
+    const int64_t m = verify_num_checks(n);
+    int64_t k, errors = 0;
+    uint64_t sum = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:errors,sum)
+#endif
+    for (k=0; k<m; k++) {
+        int64_t i = verify_index(k, n);
+        sum += verify_mix(flt_bits(B[i]));
+        errors += (i > 0 && flt_lt(B[i], B[i-1]));
+    }
+    if (verify.mode == VERIFY_FULL)
+        errors += (sum != verify.input_sum);
+    verify_end(t0, errors, what);
+}
+
+
+static int inline_qsort_serial(const float *A, const int64_t n, const int num_iterations) {
+
+    fprintf(stderr, "N %lld\n", (long long) n);
     fprintf(stderr, "Using inline qsort implementation\n");
     fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
 
     int iter;
     double avg_elt;
 
+    /* B and everything a sort needs are sized once, see sort_ctx.h */
+    sort_ctx ctx;
+    sort_ctx_init(&ctx);
+
     float *B;
-    B = (float *) malloc(n * sizeof(float));
-    assert(B != NULL);
+    B = (float *) sort_ctx_buffer(&ctx, n, sizeof(float));
+    sort_ctx_ready(&ctx);
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
 
     avg_elt = 0.0;
 
-    for (iter = 0; iter < num_iterations; iter++) {
-        
-        int i;
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
 
-        for (i=0; i<n; i++) {
-            B[i] = A[i];
-        }
+        sort_ctx_reset(&ctx, iter);
+        sort_ctx_copy(B, A, n * sizeof(float));
 
         double elt;
         elt = timer();
+        perf_begin(&pp);
 
         QSORT(float, B, n, inline_qs_cmpf);
 
+        perf_phase(&pp, "sort");
         elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
         avg_elt += elt;
         fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, n);
 
         /* correctness check */
-        for (i=1; i<n; i++) {
-            assert(B[i] >= B[i-1]);
-        }
+        verify_sorted(B, n, "inline_qsort");
 
     }
 
     avg_elt = avg_elt/num_iterations;
     
-    free(B);
+    sort_ctx_report(&ctx);
+    sort_ctx_free(&ctx);
+
+    perf_summary(&pp, n);
+    bench_report("inline_qsort", n, 4.0*n, times, num_iterations);
+    free(times);
 
     fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
     fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", 4.0*n/(avg_elt*1e6));
@@ -94,31 +154,37 @@ static int inline_qsort_serial(const float *A, const int n, const int num_iterat
 
 }
 
-static int qsort_serial(const float *A, const int n, const int num_iterations) {
+static int qsort_serial(const float *A, const int64_t n, const int num_iterations) {
 
-    fprintf(stderr, "N %d\n", n);
+    fprintf(stderr, "N %lld\n", (long long) n);
     fprintf(stderr, "Using C qsort\n");
     fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
 
     int iter;
     double avg_elt;
 
+    sort_ctx ctx;
+    sort_ctx_init(&ctx);
+
     float *B;
-    B = (float *) malloc(n * sizeof(float));
-    assert(B != NULL);
+    B = (float *) sort_ctx_buffer(&ctx, n, sizeof(float));
+    sort_ctx_ready(&ctx);
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
 
     avg_elt = 0.0;
 
-    for (iter = 0; iter < num_iterations; iter++) {
-        
-        int i;
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
 
-        for (i=0; i<n; i++) {
-            B[i] = A[i];
-        }
+        sort_ctx_reset(&ctx, iter);
+        sort_ctx_copy(B, A, n * sizeof(float));
 
         double elt;
         elt = timer();
+        perf_begin(&pp);
         
 //        printf("pre-sort: ");
 //        print_arr(B,n);
@@ -131,23 +197,242 @@ static int qsort_serial(const float *A, const int n, const int num_iterations) {
 //        }
         
 
+        perf_phase(&pp, "sort");
         elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
         avg_elt += elt;
         fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, n);
         
 //        printf("post-sort: ");
 //        print_arr(B,n);
 
         /* correctness check */
-        for (i=1; i<n; i++) {
-            assert(B[i] >= B[i-1]);
-        }
+        verify_sorted(B, n, "merge_sort");
 
     }
 
     avg_elt = avg_elt/num_iterations;
     
-    free(B);
+    sort_ctx_report(&ctx);
+    sort_ctx_free(&ctx);
+
+    perf_summary(&pp, n);
+    bench_report("merge_sort", n, 4.0*n, times, num_iterations);
+    free(times);
+
+    fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
+    fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", 4.0*n/(avg_elt*1e6));
+    return 0;
+
+}
+
+
+
+/* ------------------------------------------------------------------------
+ * Key/value sorting: float keys with a record ID (or, for an argsort, the
+ * original position) as payload.  Two layouts are supported:
+ *   packed: one array of struct { key, val } pairs,
+ *   split:  a key array and a parallel value array.
+ * The payload is 32 bits wide unless compiled with -DKV_VAL_64.
+ * ------------------------------------------------------------------------ */
+
+#ifdef KV_VAL_64
+typedef uint64_t kv_val_t;
+#else
+typedef uint32_t kv_val_t;
+#endif
+
+typedef struct {
+    float key;
+    kv_val_t val;
+} kv_pair;
+
+#define KV_ALG_MERGE    0   /* stable */
+#define KV_ALG_QSORT    1   /* not stable */
+#define KV_ALG_RADIX    2   /* stable */
+
+#define KV_LAYOUT_PACKED 0
+#define KV_LAYOUT_SPLIT  1
+
+#define kv_key(e) flt_radix_key((e)->key)
+#define kv_qs_cmpf(a,b) flt_lt((a)->key, (b)->key)
+
+/* stable LSD radix sort on the 4 key bytes; passes in which every key has
+   the same digit are skipped */
+static void kv_radix_sort_packed(kv_pair *a, kv_pair *tmp, const int64_t n) {
+    int64_t hist[4][256];
+    memset(hist, 0, sizeof(hist));
+    int64_t i;
+    int d;
+    for (i=0; i<n; i++) {
+        uint32_t k = flt_radix_key(a[i].key);
+        for (d=0; d<4; d++)
+            hist[d][(k >> (8*d)) & 0xFF]++;
+    }
+
+    kv_pair *src = a;
+    kv_pair *dst = tmp;
+    for (d=0; d<4; d++) {
+        int64_t offset = 0;
+        int b;
+        if (hist[d][(flt_radix_key(a[0].key) >> (8*d)) & 0xFF] == n)
+            continue;
+        for (b=0; b<256; b++) {
+            int64_t count = hist[d][b];
+            hist[d][b] = offset;
+            offset += count;
+        }
+        for (i=0; i<n; i++) {
+            uint32_t k = flt_radix_key(src[i].key);
+            dst[hist[d][(k >> (8*d)) & 0xFF]++] = src[i];
+        }
+        kv_pair *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != a)
+        memcpy(a, src, n * sizeof(kv_pair));
+}
+
+static void kv_radix_sort_split(float *keys, kv_val_t *vals, float *tmp_keys,
+        kv_val_t *tmp_vals, const int64_t n) {
+    int64_t hist[4][256];
+    memset(hist, 0, sizeof(hist));
+    int64_t i;
+    int d;
+    for (i=0; i<n; i++) {
+        uint32_t k = flt_radix_key(keys[i]);
+        for (d=0; d<4; d++)
+            hist[d][(k >> (8*d)) & 0xFF]++;
+    }
+
+    float *src_k = keys, *dst_k = tmp_keys;
+    kv_val_t *src_v = vals, *dst_v = tmp_vals;
+    for (d=0; d<4; d++) {
+        int64_t offset = 0;
+        int b;
+        if (hist[d][(flt_radix_key(keys[0]) >> (8*d)) & 0xFF] == n)
+            continue;
+        for (b=0; b<256; b++) {
+            int64_t count = hist[d][b];
+            hist[d][b] = offset;
+            offset += count;
+        }
+        for (i=0; i<n; i++) {
+            uint32_t k = flt_radix_key(src_k[i]);
+            int64_t pos = hist[d][(k >> (8*d)) & 0xFF]++;
+            dst_k[pos] = src_k[i];
+            dst_v[pos] = src_v[i];
+        }
+        float *swap_k = src_k;
+        src_k = dst_k;
+        dst_k = swap_k;
+        kv_val_t *swap_v = src_v;
+        src_v = dst_v;
+        dst_v = swap_v;
+    }
+    if (src_k != keys) {
+        memcpy(keys, src_k, n * sizeof(float));
+        memcpy(vals, src_v, n * sizeof(kv_val_t));
+    }
+}
+
+/* LSD radix sort of plain values, on the 4 bytes of flt_radix_key() */
+static void flt_radix_sort(float *a, float *tmp, const int64_t n) {
+    int64_t hist[4][256];
+    memset(hist, 0, sizeof(hist));
+    int64_t i;
+    int d;
+    for (i=0; i<n; i++) {
+        uint32_t k = flt_radix_key(a[i]);
+        for (d=0; d<4; d++)
+            hist[d][(k >> (8*d)) & 0xFF]++;
+    }
+
+    float *src = a, *dst = tmp;
+    for (d=0; d<4; d++) {
+        int64_t offset = 0;
+        int b;
+        if (hist[d][(flt_radix_key(a[0]) >> (8*d)) & 0xFF] == n)
+            continue;
+        for (b=0; b<256; b++) {
+            int64_t count = hist[d][b];
+            hist[d][b] = offset;
+            offset += count;
+        }
+        for (i=0; i<n; i++) {
+            int64_t pos = hist[d][(flt_radix_key(src[i]) >> (8*d)) & 0xFF]++;
+            dst[pos] = src[i];
+        }
+        float *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != a)
+        memcpy(a, src, n * sizeof(float));
+}
+
+static int radix_sort_serial(const float *A, const int64_t n, const int num_iterations) {
+
+    fprintf(stderr, "N %lld\n", (long long) n);
+    fprintf(stderr, "Using LSD radix sort\n");
+    fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
+
+    int iter;
+    double avg_elt;
+
+    sort_ctx ctx;
+    sort_ctx_init(&ctx);
+
+    float *B;
+    B = (float *) sort_ctx_buffer(&ctx, n, sizeof(float));
+    float *tmp;
+    tmp = (float *) sort_ctx_buffer(&ctx, n, sizeof(float));
+    sort_ctx_ready(&ctx);
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
+
+    avg_elt = 0.0;
+
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
+
+        sort_ctx_reset(&ctx, iter);
+        sort_ctx_copy(B, A, n * sizeof(float));
+
+        double elt;
+        elt = timer();
+        perf_begin(&pp);
+
+        flt_radix_sort(B, tmp, n);
+
+        perf_phase(&pp, "sort");
+        elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
+        avg_elt += elt;
+        fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, n);
+
+        /* correctness check */
+        verify_sorted(B, n, "radix_sort");
+
+    }
+
+    avg_elt = avg_elt/num_iterations;
+
+    sort_ctx_report(&ctx);
+    sort_ctx_free(&ctx);
+
+    perf_summary(&pp, n);
+    bench_report("radix_sort", n, 4.0*n, times, num_iterations);
+    free(times);
 
     fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
     fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", 4.0*n/(avg_elt*1e6));
@@ -155,24 +440,657 @@ static int qsort_serial(const float *A, const int n, const int num_iterations) {
 
 }
 
+/* ------------------------------------------------------------------------
+ * Block merge sort (alg_type 6): bottom-up, from cache-sized blocks.
+ *
+ * The values are sorted as their flt_radix_key()s, so every comparison is
+ * an integer one.  First every block of flt_block_len() keys, small enough
+ * that the block and its share of tmp stay in L2, is sorted on its own:
+ * groups of FLT_NET keys by a sorting network in registers, then
+ * branch-free pairwise merges that never leave the cache.  Then
+ * FLT_MERGE_WAYS runs at a time are merged through a loser tree, so the
+ * array streams through DRAM 1 + log_k(n / block) times instead of
+ * log2(n) times.  The last merge writes the floats back as it goes.
+ *
+ * With OpenMP the blocks are sorted in parallel, and while there are fewer
+ * merges than threads each merge is split into key ranges (from a sample
+ * of its runs) that are merged independently.
+ * ------------------------------------------------------------------------ */
+
+#define FLT_NET             8           /* keys sorted by the network */
+#define FLT_MERGE_WAYS      8           /* runs per loser tree merge */
+#define FLT_L2_DEFAULT      (256 << 10) /* if sysconf() does not know */
+#define FLT_SPLIT_SAMPLE    64          /* keys per run to find key ranges */
+#define FLT_MAX_PARTS       256         /* key ranges per merge */
+#define FLT_KEY_END         ((uint64_t) 1 << 32)    /* above every key */
+
+static inline float flt_from_key(uint32_t k) {
+    uint32_t u = k ^ ((k >> 31) ? 0x80000000u : 0xFFFFFFFFu);
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
 
+/* keys per block: a power of two, with the block and as much tmp in L2 */
+static int64_t flt_block_len(void) {
+    long l2 = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if (l2 <= 0)
+        l2 = FLT_L2_DEFAULT;
+    int64_t len = FLT_NET;
+    while ((int64_t) (4 * len * sizeof(uint32_t)) <= l2)
+        len *= 2;
+    return len;
+}
 
-/* generate different inputs for testing sort */
-int gen_input(float *A, int n, int input_type) {
+#define FLT_CSWAP(x, y) {                       \
+    uint32_t _lo = ((x) < (y)) ? (x) : (y);     \
+    uint32_t _hi = ((x) < (y)) ? (y) : (x);     \
+    (x) = _lo;                                  \
+    (y) = _hi;                                  \
+}
+
+/* 19 compare-exchanges, all on registers */
+static inline void flt_sort8(uint32_t *k) {
+    uint32_t k0 = k[0], k1 = k[1], k2 = k[2], k3 = k[3];
+    uint32_t k4 = k[4], k5 = k[5], k6 = k[6], k7 = k[7];
+    FLT_CSWAP(k0, k2); FLT_CSWAP(k1, k3); FLT_CSWAP(k4, k6); FLT_CSWAP(k5, k7);
+    FLT_CSWAP(k0, k4); FLT_CSWAP(k1, k5); FLT_CSWAP(k2, k6); FLT_CSWAP(k3, k7);
+    FLT_CSWAP(k0, k1); FLT_CSWAP(k2, k3); FLT_CSWAP(k4, k5); FLT_CSWAP(k6, k7);
+    FLT_CSWAP(k2, k4); FLT_CSWAP(k3, k5);
+    FLT_CSWAP(k1, k4); FLT_CSWAP(k3, k6);
+    FLT_CSWAP(k1, k2); FLT_CSWAP(k3, k4); FLT_CSWAP(k5, k6);
+    k[0] = k0; k[1] = k1; k[2] = k2; k[3] = k3;
+    k[4] = k4; k[5] = k5; k[6] = k6; k[7] = k7;
+}
+
+/* a merge of two sorted runs of keys, l and r, into out */
+typedef struct {
+    const uint32_t *l, *l_end, *r, *r_end;
+    uint32_t *out;
+} flt_merge2_state;
+
+/* one output of a merge, without branching on the keys */
+#define FLT_MERGE_STEP(m) {                     \
+    uint32_t _x = *(m)->l, _y = *(m)->r;        \
+    int _take_r = (_y < _x);                    \
+    *(m)->out++ = _take_r ? _y : _x;            \
+    (m)->r += _take_r;                          \
+    (m)->l += !_take_r;                         \
+}
 
-    int i;
+static inline int flt_merge2_in_order(const flt_merge2_state *m) {
+    return m->l == m->l_end || m->r == m->r_end || !(*m->r < m->l_end[-1]);
+}
+
+static void flt_merge2(flt_merge2_state *m) {
+    if (!flt_merge2_in_order(m)) {
+        while (m->l < m->l_end && m->r < m->r_end)
+            FLT_MERGE_STEP(m);
+    }
+    memcpy(m->out, m->l, (m->l_end - m->l) * sizeof(uint32_t));
+    m->out += m->l_end - m->l;
+    memcpy(m->out, m->r, (m->r_end - m->r) * sizeof(uint32_t));
+}
+
+/* two independent merges in one loop: every step of one depends on the
+   last, so interleaving them overlaps their load-compare latencies.  Each
+   round runs as many steps as neither merge can run out in. */
+static void flt_merge2x2(flt_merge2_state *a, flt_merge2_state *b) {
+    for (;;) {
+        int64_t steps = a->l_end - a->l;
+        if (a->r_end - a->r < steps)
+            steps = a->r_end - a->r;
+        if (b->l_end - b->l < steps)
+            steps = b->l_end - b->l;
+        if (b->r_end - b->r < steps)
+            steps = b->r_end - b->r;
+        if (steps == 0)
+            break;
+        while (steps-- > 0) {
+            FLT_MERGE_STEP(a);
+            FLT_MERGE_STEP(b);
+        }
+    }
+    flt_merge2(a);
+    flt_merge2(b);
+}
+
+/* sorts the len values at in into keys at dst; other is as much scratch,
+   and either may be in's own memory */
+static void flt_block_sort(const float *in, uint32_t *dst, uint32_t *other, const int64_t len) {
+    int64_t i, w;
+    int levels = 0;
+    for (w=FLT_NET; w<len; w*=2)
+        levels++;
+    /* start where an even number of merge levels ends in dst */
+    uint32_t *s = (levels & 1) ? other : dst;
+    uint32_t *d = (levels & 1) ? dst : other;
+
+    for (i=0; i<len; i+=FLT_NET) {
+        uint32_t k[FLT_NET];
+        int j, m = (len - i < FLT_NET) ? (int) (len - i) : FLT_NET;
+        for (j=0; j<FLT_NET; j++)
+            k[j] = (j < m) ? flt_radix_key(in[i+j]) : 0xFFFFFFFFu;
+        flt_sort8(k);
+        memcpy(s + i, k, m * sizeof(uint32_t));
+    }
+
+    for (w=FLT_NET; w<len; w*=2) {
+        flt_merge2_state m[2];
+        int pending = 0;
+        for (i=0; i<len; i+=2*w) {
+            int64_t mid = (i + w < len) ? i + w : len;
+            int64_t hi = (i + 2*w < len) ? i + 2*w : len;
+            flt_merge2_state *c = &m[pending];
+            c->l = s + i;
+            c->l_end = c->r = s + mid;
+            c->r_end = s + hi;
+            c->out = d + i;
+            if (flt_merge2_in_order(c)) {
+                flt_merge2(c);
+            } else if (++pending == 2) {
+                flt_merge2x2(&m[0], &m[1]);
+                pending = 0;
+            }
+        }
+        if (pending == 1)
+            flt_merge2(&m[0]);
+        uint32_t *swap = s;
+        s = d;
+        d = swap;
+    }
+}
+
+typedef struct {
+    const uint32_t *cur, *end;
+} flt_run;
+
+/* merges the FLT_MERGE_WAYS runs (some may be empty) into len keys at out,
+   or, if out_f is not NULL, into the len floats they stand for */
+static void flt_merge_k(flt_run *runs, uint32_t *out, float *out_f, const int64_t len) {
+    uint64_t key[FLT_MERGE_WAYS];       /* head of every run */
+    int tree[FLT_MERGE_WAYS];           /* loser of every inner node */
+    int win[2 * FLT_MERGE_WAYS];
+    int r, node;
+    int64_t i;
+
+    for (r=0; r<FLT_MERGE_WAYS; r++) {
+        key[r] = (runs[r].cur < runs[r].end) ? *runs[r].cur : FLT_KEY_END;
+        win[FLT_MERGE_WAYS + r] = r;
+    }
+    for (node=FLT_MERGE_WAYS-1; node>=1; node--) {
+        int x = win[2*node], y = win[2*node+1];
+        win[node] = (key[y] < key[x]) ? y : x;
+        tree[node] = (key[y] < key[x]) ? x : y;
+    }
+
+    int w = win[1];
+    for (i=0; i<len; i++) {
+        uint32_t k = (uint32_t) key[w];
+        if (out_f != NULL)
+            out_f[i] = flt_from_key(k);
+        else
+            out[i] = k;
+        runs[w].cur++;
+        key[w] = (runs[w].cur < runs[w].end) ? *runs[w].cur : FLT_KEY_END;
+        /* replay the matches on the path to the root, without branches */
+        uint64_t kw = key[w];
+        for (node=(w + FLT_MERGE_WAYS) >> 1; node>=1; node>>=1) {
+            int loser = tree[node];
+            uint64_t kl = key[loser];
+            int swap = (kl < kw);
+            tree[node] = swap ? w : loser;
+            w = swap ? loser : w;
+            kw = swap ? kl : kw;
+        }
+    }
+}
+
+static int64_t flt_key_lower_bound(const uint32_t *a, int64_t len, uint64_t k) {
+    int64_t lo = 0, hi = len;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (a[mid] < k)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* the key ranges [split[p], split[p+1]) splitting the runs into parts of
+   about equal size: quantiles of a sample of every run */
+static void flt_split_keys(const flt_run *runs, const int parts, uint64_t *split) {
+    uint32_t sample[FLT_MERGE_WAYS * FLT_SPLIT_SAMPLE];
+    int r, j, m = 0;
+    for (r=0; r<FLT_MERGE_WAYS; r++) {
+        int64_t len = runs[r].end - runs[r].cur;
+        if (len == 0)
+            continue;
+        for (j=0; j<FLT_SPLIT_SAMPLE; j++)
+            sample[m++] = runs[r].cur[(len * j) / FLT_SPLIT_SAMPLE];
+    }
+    for (j=1; j<m; j++) {
+        uint32_t hold = sample[j];
+        int k = j;
+        while (k > 0 && hold < sample[k-1]) {
+            sample[k] = sample[k-1];
+            k--;
+        }
+        sample[k] = hold;
+    }
+    split[0] = 0;
+    for (j=1; j<parts; j++)
+        split[j] = (m > 0) ? sample[((int64_t) m * j) / parts] : FLT_KEY_END;
+    split[parts] = FLT_KEY_END;
+}
+
+/* merges every FLT_MERGE_WAYS runs of w keys of src into dst, or into the
+   floats at dst_f on the last pass */
+static void flt_merge_pass(const uint32_t *src, uint32_t *dst, float *dst_f,
+        const int64_t n, const int64_t w) {
+    const int64_t span = w * FLT_MERGE_WAYS;
+    const int64_t groups = (n + span - 1) / span;
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    int parts = (groups < threads) ? (int) ((threads + groups - 1) / groups) : 1;
+    if (parts > FLT_MAX_PARTS)
+        parts = FLT_MAX_PARTS;
+    int64_t task, num_tasks = groups * parts;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (task=0; task<num_tasks; task++) {
+        const int64_t lo = (task / parts) * span;
+        const int p = (int) (task % parts);
+        flt_run runs[FLT_MERGE_WAYS];
+        int r;
+        for (r=0; r<FLT_MERGE_WAYS; r++) {
+            int64_t b = (lo + r*w < n) ? lo + r*w : n;
+            int64_t e = (lo + (r+1)*w < n) ? lo + (r+1)*w : n;
+            runs[r].cur = src + b;
+            runs[r].end = src + e;
+        }
+
+        /* narrow every run to the part's key range; the output starts
+           after everything below it */
+        int64_t out = lo;
+        if (parts > 1) {
+            uint64_t split[FLT_MAX_PARTS + 1];
+            flt_split_keys(runs, parts, split);
+            for (r=0; r<FLT_MERGE_WAYS; r++) {
+                int64_t len = runs[r].end - runs[r].cur;
+                int64_t b = flt_key_lower_bound(runs[r].cur, len, split[p]);
+                int64_t e = flt_key_lower_bound(runs[r].cur, len, split[p+1]);
+                out += b;
+                runs[r].end = runs[r].cur + e;
+                runs[r].cur += b;
+            }
+        }
+
+        int64_t len = 0;
+        int in_order = 1;
+        const uint32_t *last = NULL;
+        for (r=0; r<FLT_MERGE_WAYS; r++) {
+            if (runs[r].cur == runs[r].end)
+                continue;
+            len += runs[r].end - runs[r].cur;
+            if (last != NULL && *runs[r].cur < *last)
+                in_order = 0;
+            last = runs[r].end - 1;
+        }
+
+        if (!in_order) {
+            flt_merge_k(runs, dst + out, (dst_f != NULL) ? dst_f + out : NULL, len);
+            continue;
+        }
+        /* already in order: copy the runs one after the other */
+        for (r=0; r<FLT_MERGE_WAYS; r++) {
+            int64_t k, run_len = runs[r].end - runs[r].cur;
+            if (dst_f != NULL) {
+                for (k=0; k<run_len; k++)
+                    dst_f[out + k] = flt_from_key(runs[r].cur[k]);
+            } else {
+                memcpy(dst + out, runs[r].cur, run_len * sizeof(uint32_t));
+            }
+            out += run_len;
+        }
+    }
+}
+
+static void flt_block_merge_sort(float *a, float *tmp, const int64_t n) {
+    const int64_t block = flt_block_len();
+    uint32_t *ka = (uint32_t *) a, *kt = (uint32_t *) tmp;
+    int64_t w, i;
+    int passes = 0;
+    for (w=block; w<n; w*=FLT_MERGE_WAYS)
+        passes++;
+
+    /* the blocks are sorted into the buffer from which the passes end in a */
+    uint32_t *src = (passes & 1) ? kt : ka;
+    uint32_t *dst = (passes & 1) ? ka : kt;
+    const int64_t num_blocks = (n + block - 1) / block;
+    int64_t b;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (b=0; b<num_blocks; b++) {
+        int64_t lo = b * block;
+        int64_t len = (n - lo < block) ? n - lo : block;
+        flt_block_sort(a + lo, src + lo, dst + lo, len);
+    }
+
+    if (passes == 0) {
+        /* one block: its keys are in a */
+        for (i=0; i<n; i++)
+            a[i] = flt_from_key(ka[i]);
+        return;
+    }
+
+    for (w=block; w<n; w*=FLT_MERGE_WAYS) {
+        int last = (w * FLT_MERGE_WAYS >= n);
+        flt_merge_pass(src, dst, last ? (float *) dst : NULL, n, w);
+        uint32_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+}
+
+static int block_merge_sort_serial(const float *A, const int64_t n, const int num_iterations) {
+
+    fprintf(stderr, "N %lld\n", (long long) n);
+    fprintf(stderr, "Using block merge sort, %lld-key blocks, %d-way merges\n",
+            (long long) flt_block_len(), FLT_MERGE_WAYS);
+    fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
+
+    int iter;
+    double avg_elt;
+
+    sort_ctx ctx;
+    sort_ctx_init(&ctx);
+
+    float *B;
+    B = (float *) sort_ctx_buffer(&ctx, n, sizeof(float));
+    float *tmp;
+    tmp = (float *) sort_ctx_buffer(&ctx, n, sizeof(float));
+    sort_ctx_ready(&ctx);
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
+
+    avg_elt = 0.0;
+
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
+
+        sort_ctx_reset(&ctx, iter);
+        sort_ctx_copy(B, A, n * sizeof(float));
+
+        double elt;
+        elt = timer();
+        perf_begin(&pp);
+
+        flt_block_merge_sort(B, tmp, n);
+
+        perf_phase(&pp, "sort");
+        elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
+        avg_elt += elt;
+        fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, n);
+
+        /* correctness check */
+        verify_sorted(B, n, "block_merge_sort");
+
+    }
+
+    avg_elt = avg_elt/num_iterations;
+
+    sort_ctx_report(&ctx);
+    sort_ctx_free(&ctx);
+
+    perf_summary(&pp, n);
+    bench_report("block_merge_sort", n, 4.0*n, times, num_iterations);
+    free(times);
+
+    fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
+    fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", 4.0*n/(avg_elt*1e6));
+    return 0;
+
+}
+
+/* checks the pairs (from P, or from keys and vals): sorted, every value is
+   the position of its key in A, equal keys in value order when stable, and
+   in full mode that the values are a permutation of 0..n-1 (their checksum
+   less that of 0..n-1 is zero) */
+static void verify_kv(const float *A, const int64_t n, const kv_pair *P,
+        const float *keys, const kv_val_t *vals, const int stable, const char *what) {
+    double t0 = verify_begin();
+    const int64_t m = verify_num_checks(n);
+    int64_t k, errors = 0;
+    uint64_t sum = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:errors,sum)
+#endif
+    for (k=0; k<m; k++) {
+        int64_t i = verify_index(k, n);
+        float key = (P != NULL) ? P[i].key : keys[i];
+        kv_val_t val = (P != NULL) ? P[i].val : vals[i];
+        sum += verify_mix(val) - verify_mix(k);
+        if (val >= (kv_val_t) n || flt_bits(A[val]) != flt_bits(key)) {
+            errors++;
+            continue;
+        }
+        if (i == 0)
+            continue;
+        float prev_key = (P != NULL) ? P[i-1].key : keys[i-1];
+        kv_val_t prev_val = (P != NULL) ? P[i-1].val : vals[i-1];
+        errors += flt_lt(key, prev_key);
+        errors += (stable && flt_bits(key) == flt_bits(prev_key) && val <= prev_val);
+    }
+    if (verify.mode == VERIFY_FULL)
+        errors += (sum != 0);
+    verify_end(t0, errors, what);
+}
+
+/* sorts (A[i], i) pairs by key, i.e. an argsort of A */
+static int kv_sort_serial(const float *A, const int64_t n, const int num_iterations,
+        const int kv_alg, const int layout) {
+
+    static const char *alg_names[] = { "merge", "qsort", "radix" };
+    static const char *layout_names[] = { "packed", "split" };
+    char label[64];
+    snprintf(label, sizeof(label), "kv_%s_%s", alg_names[kv_alg], layout_names[layout]);
+
+    fprintf(stderr, "N %lld\n", (long long) n);
+    fprintf(stderr, "Using key/value %s sort, %s layout, %d-bit values\n",
+            alg_names[kv_alg], layout_names[layout], (int) (8 * sizeof(kv_val_t)));
+    fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
+
+    /* record IDs are positions in A; build with -DKV_VAL_64 past 2^32 */
+    assert((uint64_t) n - 1 <= (uint64_t) (kv_val_t) -1);
+
+    /* QSORT() moves whole elements of one array */
+    assert(!(kv_alg == KV_ALG_QSORT && layout == KV_LAYOUT_SPLIT));
+
+    int iter;
+    double avg_elt;
+
+    kv_pair *P = NULL, *P_tmp = NULL;
+    float *keys = NULL, *keys_tmp = NULL;
+    kv_val_t *vals = NULL, *vals_tmp = NULL;
+    /* the records are built once, into P0 or keys0/vals0, and copied in
+       bulk before every iteration */
+    kv_pair *P0 = NULL;
+    float *keys0 = NULL;
+    kv_val_t *vals0 = NULL;
+    sort_ctx ctx;
+    sort_ctx_init(&ctx);
+    if (layout == KV_LAYOUT_PACKED) {
+        P = (kv_pair *) sort_ctx_buffer(&ctx, n, sizeof(kv_pair));
+        P_tmp = (kv_pair *) sort_ctx_buffer(&ctx, n, sizeof(kv_pair));
+        P0 = (kv_pair *) sort_ctx_buffer(&ctx, n, sizeof(kv_pair));
+    } else {
+        keys = (float *) sort_ctx_buffer(&ctx, n, sizeof(float));
+        keys_tmp = (float *) sort_ctx_buffer(&ctx, n, sizeof(float));
+        keys0 = (float *) sort_ctx_buffer(&ctx, n, sizeof(float));
+        vals = (kv_val_t *) sort_ctx_buffer(&ctx, n, sizeof(kv_val_t));
+        vals_tmp = (kv_val_t *) sort_ctx_buffer(&ctx, n, sizeof(kv_val_t));
+        vals0 = (kv_val_t *) sort_ctx_buffer(&ctx, n, sizeof(kv_val_t));
+    }
+    sort_ctx_ready(&ctx);
+
+    int64_t i;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (i=0; i<n; i++) {
+        if (layout == KV_LAYOUT_PACKED) {
+            P0[i].key = A[i];
+            P0[i].val = (kv_val_t) i;
+        } else {
+            keys0[i] = A[i];
+            vals0[i] = (kv_val_t) i;
+        }
+    }
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
+
+    avg_elt = 0.0;
+
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
+
+        sort_ctx_reset(&ctx, iter);
+        if (layout == KV_LAYOUT_PACKED) {
+            sort_ctx_copy(P, P0, n * sizeof(kv_pair));
+        } else {
+            sort_ctx_copy(keys, keys0, n * sizeof(float));
+            sort_ctx_copy(vals, vals0, n * sizeof(kv_val_t));
+        }
+
+        double elt;
+        elt = timer();
+        perf_begin(&pp);
+
+        if (layout == KV_LAYOUT_PACKED) {
+            if (kv_alg == KV_ALG_MERGE) {
+                MSORT_BY_KEY(kv_pair, P, n, kv_key, P_tmp);
+            } else if (kv_alg == KV_ALG_QSORT) {
+                QSORT(kv_pair, P, n, kv_qs_cmpf);
+            } else {
+                kv_radix_sort_packed(P, P_tmp, n);
+            }
+        } else {
+            if (kv_alg == KV_ALG_MERGE)
+                MSORT_PAIRED(float, keys, n, inline_qs_cmpf, keys_tmp,
+                             kv_val_t, vals, vals_tmp);
+            else
+                kv_radix_sort_split(keys, vals, keys_tmp, vals_tmp, n);
+        }
+
+        perf_phase(&pp, "sort");
+        elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
+        avg_elt += elt;
+        fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, n);
+
+        /* correctness check: sorted, every value still points at its key,
+           and the stable sorts keep equal keys in input order */
+        verify_kv(A, n, P, keys, vals, kv_alg != KV_ALG_QSORT, label);
+
+    }
+
+    avg_elt = avg_elt/num_iterations;
+
+    sort_ctx_report(&ctx);
+    sort_ctx_free(&ctx);
+
+    double bytes = (double) n * (sizeof(float) + sizeof(kv_val_t));
+    perf_summary(&pp, n);
+    bench_report(label, n, bytes, times, num_iterations);
+    free(times);
+
+    fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
+    fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", bytes/(avg_elt*1e6));
+    return 0;
+
+}
+
+
+#define GEN_TEETH 16     /* ascending runs of the sawtooth input */
+
+/* a finite float with random sign, exponent and mantissa */
+static float gen_wide(uint64_t r) {
+    uint32_t u = (uint32_t) r & 0x807FFFFFu;
+    u |= (uint32_t) (1 + (r >> 32) % 254) << 23;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/* mostly uniform in [-1, 1), with 1% each of NaN, +-inf, denormals and
+   +-0.0 */
+static float gen_special(uint64_t r) {
+    uint32_t u;
+    float f;
+    switch ((r >> 32) % 100) {
+    case 0:
+        return NAN;
+    case 1:
+        return INFINITY;
+    case 2:
+        return -INFINITY;
+    case 3:
+        u = ((uint32_t) r & 0x807FFFFFu) | 1;  /* exponent 0: denormal */
+        memcpy(&f, &u, sizeof(f));
+        return f;
+    case 4:
+        return -0.0f;
+    case 5:
+        return 0.0f;
+    default:
+        return (float) ((int32_t) r) / 2147483648.0f;
+    }
+}
+
+/* generate different inputs for testing sort; every element is a function
+   of its index and the seed, so the loops run in parallel */
+int gen_input(float *A, int64_t n, int input_type) {
+
+    int64_t i;
+    const uint64_t seed = gen_seed;
 
     /* uniform random values */
     if (input_type == 0) {
 
-        srand(123);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
         for (i=0; i<n; i++) {
-            A[i] = ((float) rand())/((float) RAND_MAX);
+            A[i] = (float) gen_unit(seed, i);
         }
 
     /* sorted values */    
     } else if (input_type == 1) {
 
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
         for (i=0; i<n; i++) {
             A[i] = (float) i;
         }
@@ -180,16 +1098,20 @@ int gen_input(float *A, int n, int input_type) {
     /* almost sorted */    
     } else if (input_type == 2) {
 
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
         for (i=0; i<n; i++) {
             A[i] = (float) i;
         }
 
         /* do a few shuffles */
-        int num_shuffles = (n/100) + 1;
-        srand(1234);
+        int64_t num_shuffles = (n/100) + 1;
         for (i=0; i<num_shuffles; i++) {
-            int j = (rand() % n);
-            int k = (rand() % n);
+            uint32_t r[4];
+            gen_philox(seed + 1, i, r);
+            int64_t j = (int64_t) ((((uint64_t) r[0] << 32) | r[1]) % (uint64_t) n);
+            int64_t k = (int64_t) ((((uint64_t) r[2] << 32) | r[3]) % (uint64_t) n);
 
             /* swap A[j] and A[k] */
             float tmpval = A[j];
@@ -200,173 +1122,430 @@ int gen_input(float *A, int n, int input_type) {
     /* array with single unique value */    
     } else if (input_type == 3) {
 
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
         for (i=0; i<n; i++) {
             A[i] = 1.0;
         }
 
     /* sorted in reverse */    
-    } else {
+    } else if (input_type == 4) {
 
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
         for (i=0; i<n; i++) {
             A[i] = (float) (n + 1.0 - i);
         }
 
+    /* negative and positive values over the whole float range */
+    } else if (input_type == 5) {
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (i=0; i<n; i++) {
+            A[i] = gen_wide(gen_u64(seed, i));
+        }
+
+    /* special values mixed in */
+    } else if (input_type == 6) {
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (i=0; i<n; i++) {
+            A[i] = gen_special(gen_u64(seed, i));
+        }
+
+    /* Zipf distributed duplicates: the value of rank r is random too, so
+       the frequent values are spread over [0, 1) */
+    } else if (input_type == 7) {
+
+        gen_zipf_table z;
+        gen_zipf_init(&z, (n < GEN_ZIPF_VOCAB) ? n : GEN_ZIPF_VOCAB);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (i=0; i<n; i++) {
+            A[i] = (float) gen_unit(seed + 1, gen_zipf(&z, gen_unit(seed, i)));
+        }
+        gen_zipf_free(&z);
+
+    /* GEN_TEETH ascending runs */
+    } else if (input_type == 8) {
+
+        int64_t tooth = (n + GEN_TEETH - 1) / GEN_TEETH;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (i=0; i<n; i++) {
+            A[i] = (float) (i % tooth);
+        }
+
+    /* organ pipe: ascending, then descending */
+    } else {
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (i=0; i<n; i++) {
+            A[i] = (float) ((i < n/2) ? i : n - 1 - i);
+        }
+
     }
 
     return 0;
 
 }
 
-void print_arr(float * a, int n) {
-    int i;
+void print_arr(float * a, int64_t n) {
+    int64_t i;
     for (i=0; i<n; i++)
         printf("%f ", a[i]);
     printf("\n");
 }
 
-void stephen_merge_sort(float * a, int n) {
-    //printf("call n=%d ",n);
-    //print_arr(a,n);
-    
-    // IF the fragment is small we sort the small fragment
-    if (n <= 1) {
-        return;
-    }
-    else if (n == 2) {
-        if (a[0] > a[1]) {
-            //printf("Pre-sort ");
-            //print_arr(a,n);
-            float temp = a[0];
-            a[0] = a[1];
-            a[1] = temp;
-            //printf("Post-sort ");
-            //print_arr(a,n);
+void stephen_merge_sort(float * a, int64_t n) {
+    arena *scratch = arena_local();
+    arena_mark mark = arena_save(scratch);
+    float *tmp = (float *) arena_alloc_array(scratch, n, sizeof(float));
+    MSORT(float, a, n, inline_qs_cmpf, tmp);
+    arena_release(scratch, mark);
+}
+
+
+/* labels for the benchmark output, indexed by input_type */
+static const char *input_type_names[] = {
+    "random", "sorted", "almostsorted", "single", "revsorted",
+    "signed", "special", "zipf", "sawtooth", "organpipe"
+};
+
+static int sort_alg(int alg_type, const float *A, const int64_t n, const int num_iterations,
+        const int layout) {
+    if (alg_type == 0)
+        return qsort_serial(A, n, num_iterations);
+    if (alg_type == 1)
+        return inline_qsort_serial(A, n, num_iterations);
+    if (alg_type == 2)
+        return kv_sort_serial(A, n, num_iterations, KV_ALG_MERGE, layout);
+    if (alg_type == 3)
+        return kv_sort_serial(A, n, num_iterations, KV_ALG_QSORT, layout);
+    if (alg_type == 4)
+        return kv_sort_serial(A, n, num_iterations, KV_ALG_RADIX, layout);
+    if (alg_type == 5)
+        return radix_sort_serial(A, n, num_iterations);
+    return block_merge_sort_serial(A, n, num_iterations);
+}
+
+/* ------------------------------------------------------------------------
+ * Automatic choice of the sort ("best" as alg_type, see tune.h).
+ *
+ * A sample of FLT_SAMPLE adjacent pairs and FLT_SAMPLE values puts the
+ * input in one class: sorted or reversed (few pairs out of order),
+ * many duplicates, small, or random.  Each class has its own winner
+ * among the value sorts 0 (merge sort, which skips merges of runs already
+ * in order), 1 (quicksort), 5 (radix sort) and 6 (block merge sort).  A
+ * tuning run times the four on inputs of every class, and finds the size
+ * below which the random-input winner loses, to set small_max.
+ * ------------------------------------------------------------------------ */
+
+#define FLT_SAMPLE          4096
+
+#define FLT_CLASS_SORTED    0
+#define FLT_CLASS_REVERSED  1
+#define FLT_CLASS_DUPS      2
+#define FLT_CLASS_SMALL     3
+#define FLT_CLASS_RANDOM    4
+#define FLT_NUM_CLASSES     5
+
+static const char *flt_class_names[FLT_NUM_CLASSES] = {
+    "sorted", "reversed", "dups", "small", "random"
+};
+
+/* the tuning parameter naming each class's winner, and its default */
+static const char *flt_class_params[FLT_NUM_CLASSES] = {
+    "alg_sorted", "alg_reversed", "alg_dups", "alg_small", "alg_random"
+};
+static const int flt_class_default[FLT_NUM_CLASSES] = { 0, 1, 5, 1, 5 };
+
+static const int flt_candidates[] = { 0, 1, 5, 6 };
+#define FLT_NUM_CANDIDATES ((int) (sizeof(flt_candidates) / sizeof(flt_candidates[0])))
+
+typedef struct {
+    double descents;    /* fraction of sampled pairs out of order */
+    double ascents;     /* fraction of sampled pairs in strictly increasing order */
+    double dups;        /* 1 - distinct / sampled values */
+} flt_stats;
+
+static flt_stats flt_sample_stats(const float *A, const int64_t n) {
+    flt_stats st;
+    float sample[FLT_SAMPLE], tmp[FLT_SAMPLE];
+    const uint64_t seed = gen_seed ^ 0x73616d70ULL;
+    int64_t k, m = (n < FLT_SAMPLE) ? n : FLT_SAMPLE;
+    int64_t down = 0, up = 0;
+
+    memset(&st, 0, sizeof(st));
+    for (k=0; k<m; k++) {
+        int64_t i = (m == n) ? k : (int64_t) (gen_u64(seed, k) % (uint64_t) n);
+        sample[k] = A[i];
+        if (i + 1 < n) {
+            down += flt_lt(A[i+1], A[i]);
+            up += flt_lt(A[i], A[i+1]);
         }
-        return;
     }
-    
+    st.descents = (double) down / m;
+    st.ascents = (double) up / m;
+
+    flt_radix_sort(sample, tmp, m);
+    int64_t distinct = 1;
+    for (k=1; k<m; k++)
+        distinct += (flt_radix_key(sample[k]) != flt_radix_key(sample[k-1]));
+    st.dups = 1.0 - (double) distinct / m;
+    return st;
+}
 
-    
-    // OTHERWISE the fragment is large (n>2) and so we must split the fragment
-    // Boundary calculations:
-    //          START   SIZE
-    //  LEFT    0       n/2
-    //  RIGHT   n/2     n-n/2
-    
-    
-//#pragma omp task// firstprivate (a,n)
-    const int PARALLEL_LIMIT = 512; // only spawn threads at a minimum threshold to prevent too much thread overhead
-    if (PARALLEL_LIMIT>512) {
-#pragma omp parallel sections
-    {
-#pragma omp section
-    stephen_merge_sort(&a[0], n/2);     // left side
-#pragma omp section
-    stephen_merge_sort(&a[n/2], n-n/2); // right side
+static int flt_classify(const flt_stats *st, const int64_t n) {
+    double presorted_max = tune_get("presorted_max", 0.05);
+    if (st->descents <= presorted_max)
+        return FLT_CLASS_SORTED;
+    if (st->ascents <= presorted_max)
+        return FLT_CLASS_REVERSED;
+    if (st->dups >= tune_get("dup_min", 0.25))
+        return FLT_CLASS_DUPS;
+    if (n <= (int64_t) tune_get("small_max", 65536))
+        return FLT_CLASS_SMALL;
+    return FLT_CLASS_RANDOM;
+}
+
+static int flt_best_alg(const float *A, const int64_t n) {
+    if (tune_load() != 0)
+        fprintf(stderr, "No tuning file %s, using defaults (run with alg_type tune)\n", tune.path);
+    double elt = timer();
+    flt_stats st = flt_sample_stats(A, n);
+    int c = flt_classify(&st, n);
+    int alg = (int) tune_get(flt_class_params[c], flt_class_default[c]);
+    /* sort_alg() runs anything else as the block merge sort */
+    int a;
+    for (a=0; a<FLT_NUM_CANDIDATES && flt_candidates[a] != alg; a++)
+        ;
+    if (a == FLT_NUM_CANDIDATES) {
+        fprintf(stderr, "Ignoring %s = %d in %s: not one of the tuned alg_types\n",
+                flt_class_params[c], alg, tune.path);
+        alg = flt_class_default[c];
     }
+    elt = timer() - elt;
+    fprintf(stderr, "Input sample: %.3lf out of order, %.3lf in order, %.3lf duplicates\n",
+            st.descents, st.ascents, st.dups);
+    fprintf(stderr, "Input class %s: using alg_type %d (chosen in %.3lf ms)\n",
+            flt_class_names[c], alg, elt*1e3);
+    return alg;
+}
+
+/* median time of every candidate on input_type at size n, quietly; returns
+   the fastest */
+static int flt_trial(int input_type, const int64_t n, double *best_ms) {
+    float *T = (float *) numa_alloc_array(n, sizeof(float));
+    gen_input(T, n, input_type);
+    int iters = (int) ((1 << 20) / n);
+    iters = (iters < 3) ? 3 : (iters > 100) ? 100 : iters;
+    int c, winner = flt_candidates[0];
+    *best_ms = -1.0;
+    for (c=0; c<FLT_NUM_CANDIDATES; c++) {
+        tune_quiet(1);
+        sort_alg(flt_candidates[c], T, n, iters, KV_LAYOUT_PACKED);
+        tune_quiet(0);
+        double ms = bench_last_median * 1e3;
+        fprintf(stderr, " %d:%.3lf", flt_candidates[c], ms);
+        if (*best_ms < 0.0 || ms < *best_ms) {
+            *best_ms = ms;
+            winner = flt_candidates[c];
+        }
     }
-    else {
-        stephen_merge_sort(&a[0], n/2);     // left side
-        stephen_merge_sort(&a[n/2], n-n/2); // right side
+    numa_free(T);
+    return winner;
+}
+
+static void flt_tune(const int64_t n) {
+    /* inputs standing for each class: almost sorted, reversed, Zipf */
+    static const int class_input[3] = { 2, 4, 7 };
+    int saved_format = bench_cfg.format;
+    int saved_verify = verify.mode;
+    bench_cfg.format = BENCH_FORMAT_NONE;
+    verify.mode = VERIFY_OFF;
+    tune_load();
+
+    fprintf(stderr, "Tuning on n = %lld, median ms per alg_type:\n", (long long) n);
+    double ms;
+    int c;
+    for (c=0; c<3; c++) {
+        fprintf(stderr, "%-9s", flt_class_names[c]);
+        int winner = flt_trial(class_input[c], n, &ms);
+        fprintf(stderr, " -> %d\n", winner);
+        tune_set(flt_class_params[c], winner);
     }
-    
-    //printf("pre-merge\n");
-    //printf("left: ");
-    //print_arr(a,n/2);
-    //printf("right: ");
-    //print_arr(&a[n/2], n-n/2);
-    
-    // now we must merge the two fragments
-    // first we add a temporary array to hold the two fragments
-    float * temp_a = (float *)malloc(n * sizeof(float));
-    int temp_a_i = 0;
-    int left_i = 0;
-    int right_i = n/2;
-    while (left_i < n/2 || right_i < n) {
-        // case 1. we have not reached the end of EITHER fragment
-        if (left_i < n/2 && right_i < n) {
-            if (a[left_i] < a[right_i]) {
-                temp_a[temp_a_i] = a[left_i];
-                left_i ++;
-            }
-            else {
-                temp_a[temp_a_i] = a[right_i];
-                right_i ++;
-            }
-        }
-        // case 2. we have not reached the end of ONLY the left side
-        else if (left_i < n/2) {
-            temp_a[temp_a_i] = a[left_i];
-            left_i ++;
-        }
-        // case 3. we have not reached the end of ONLY the right side
-        else {
-            temp_a[temp_a_i] = a[right_i];
-            right_i ++;
+
+    /* random input from 1K up: the winner at n, and the largest size at
+       which another alg_type still wins */
+    int64_t m, sizes[16];
+    int winners[16], num_sizes = 0;
+    for (m=1024; m<n && num_sizes<15; m*=4)
+        sizes[num_sizes++] = m;
+    sizes[num_sizes++] = n;
+    for (c=0; c<num_sizes; c++) {
+        fprintf(stderr, "random %-9lld", (long long) sizes[c]);
+        winners[c] = flt_trial(0, sizes[c], &ms);
+        fprintf(stderr, " -> %d\n", winners[c]);
+    }
+    int large = winners[num_sizes-1];
+    int64_t small_max = 0;
+    for (c=num_sizes-2; c>=0; c--) {
+        if (winners[c] != large) {
+            small_max = sizes[c];
+            break;
         }
-        temp_a_i ++;
     }
-    
-    //printf("temp array: ");
-    //print_arr(temp_a, n);
-    
-    memcpy(a, temp_a, n * sizeof(float));   // copy our work to the main array
-    free(temp_a);           // free the temporary array
-    
-    //printf("post-merge: ");
-    //print_arr(a,n);
-    
-    // the fragements for this section are now successfully sorted. we now return.
-    return;
-    
+    tune_set("alg_random", large);
+    tune_set("alg_small", winners[0]);
+    tune_set("small_max", (double) small_max);
+    tune_get("presorted_max", 0.05);
+    tune_get("dup_min", 0.25);
+
+    if (tune_save("flt_val_sort") == 0)
+        fprintf(stderr, "Tuning parameters written to %s\n", tune.path);
+    bench_cfg.format = saved_format;
+    verify.mode = saved_verify;
 }
 
-
 int main(int argc, char **argv) {
 
-    if (argc != 4) {
-        fprintf(stderr, "%s <n> <input_type> <alg_type>\n", argv[0]);
+    int num_iterations = 10;
+    int layout = KV_LAYOUT_PACKED;
+
+    int num_threads = 0;
+    pool_affinity affinity = pool_parse_affinity("none");
+    int numa_policy = NUMA_DEFAULT;
+    const char *tune_file = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:w:f:pl:T:a:N:H:V:S:C:")) != -1) {
+        if (opt == 'l') {
+            layout = (strcmp(optarg, "split") == 0) ? KV_LAYOUT_SPLIT : KV_LAYOUT_PACKED;
+        } else if (opt == 'i') {
+            num_iterations = atoi(optarg);
+        } else if (opt == 'w') {
+            bench_cfg.num_warmup = atoi(optarg);
+        } else if (opt == 'f') {
+            bench_cfg.format = bench_parse_format(optarg);
+        } else if (opt == 'p') {
+            perf_open();
+        } else if (opt == 'T') {
+            num_threads = atoi(optarg);
+        } else if (opt == 'a') {
+            affinity = pool_parse_affinity(optarg);
+        } else if (opt == 'N') {
+            numa_policy = numa_parse_policy(optarg);
+        } else if (opt == 'H') {
+            huge.mode = huge_parse_mode(optarg);
+        } else if (opt == 'V') {
+            verify.mode = verify_parse_mode(optarg);
+        } else if (opt == 'S') {
+            gen_seed = strtoull(optarg, NULL, 0);
+        } else if (opt == 'C') {
+            tune_file = optarg;
+        } else {
+            argc = 0;   /* print usage */
+        }
+    }
+
+    if (argc - optind != 3) {
+        fprintf(stderr, "%s [options] <n> <input_type> <alg_type>\n", argv[0]);
         fprintf(stderr, "input_type 0: uniform random\n");
         fprintf(stderr, "           1: already sorted\n");
         fprintf(stderr, "           2: almost sorted\n");
         fprintf(stderr, "           3: single unique value\n");
         fprintf(stderr, "           4: sorted in reverse\n");
+        fprintf(stderr, "           5: random sign and exponent, whole float range\n");
+        fprintf(stderr, "           6: uniform in [-1, 1) with NaN, +-inf, denormals, +-0\n");
+        fprintf(stderr, "           7: Zipf distributed duplicates\n");
+        fprintf(stderr, "           8: sawtooth, %d ascending runs\n", GEN_TEETH);
+        fprintf(stderr, "           9: organ pipe\n");
         fprintf(stderr, "alg_type 0: use C qsort\n");
         fprintf(stderr, "         1: use inline qsort\n");
+        fprintf(stderr, "         2: key/value merge sort (stable)\n");
+        fprintf(stderr, "         3: key/value inline qsort (packed layout only)\n");
+        fprintf(stderr, "         4: key/value LSD radix sort (stable)\n");
+        fprintf(stderr, "         5: LSD radix sort\n");
+        fprintf(stderr, "         6: block merge sort: L2-sized blocks, then %d-way merges\n", FLT_MERGE_WAYS);
+        fprintf(stderr, "         best: pick 0, 1, 5 or 6 from a sample of the input and the tuning file\n");
+        fprintf(stderr, "         tune: time 0, 1, 5 and 6 on every class of input, write the tuning file\n");
+        fprintf(stderr, "options -i <n>: timed iterations (default 10)\n");
+        fprintf(stderr, "        -w <n>: untimed warm-up iterations (default 1)\n");
+        fprintf(stderr, "        -f csv|json: print results in a machine readable format\n");
+        fprintf(stderr, "        -p:     report hardware performance counters\n");
+        fprintf(stderr, "        -l packed|split: key/value layout for alg_type 2-4 (default packed)\n");
+        fprintf(stderr, "        -T <n>: worker threads (default OMP_NUM_THREADS)\n");
+        fprintf(stderr, "        -a none|compact|scatter|node<N>: pin worker threads (default none)\n");
+        fprintf(stderr, "        -N default|firsttouch|interleave: NUMA placement of the input and scratch\n");
+        fprintf(stderr, "        -H off|thp|hugetlb: huge pages for the input and scratch (default thp)\n");
+        fprintf(stderr, "        -V full|sample[<n>]|off: check results after every iteration (default full)\n");
+        fprintf(stderr, "        -S <seed>: seed for the random inputs (default 123)\n");
+        fprintf(stderr, "        -C <file>: tuning file for best and tune (default flt_val_sort.tune)\n");
         exit(1);
     }
 //    printf("num threads: %d\n", omp_num_threads());
 
-    int n;
+    /* after perf_open(): the counters follow threads created from here on */
+    pool_init(num_threads, affinity);
+    numa_init(numa_policy);
+
+    int64_t n;
 
-    n = atoi(argv[1]);
+    n = atoll(argv[optind]);
 
     assert(n > 0);
-    assert(n <= 1000000000);
+    assert(num_iterations > 0);
+    assert(bench_cfg.num_warmup >= 0);
 
     float *A;
-    A = (float *) malloc(n * sizeof(float));
-    assert(A != 0);
+    A = (float *) numa_alloc_array(n, sizeof(float));
 
-    int input_type = atoi(argv[2]);
+    int input_type = atoi(argv[optind+1]);
     assert(input_type >= 0);
-    assert(input_type <= 4);
+    assert(input_type <= 9);
 
-    gen_input(A, n, input_type);
+    bench_cfg.program = "flt_val_sort";
+    tune_set_path(bench_cfg.program, tune_file);
+    bench_cfg.input = input_type_names[input_type];
 
-    int alg_type = atoi(argv[3]);
+    gen_input(A, n, input_type);
+    numa_report_pages("Input", A, n * sizeof(float));
+    bench_cfg.pages = huge_page_desc(A);
+    fprintf(stderr, "Input pages: %s\n", bench_cfg.pages);
+
+    /* reference for the multiset checks, charged to verification */
+    if (verify.mode == VERIFY_FULL) {
+        double t0 = verify_begin();
+        verify.input_sum = flt_checksum(A, n);
+        verify_end(t0, 0, "input checksum");
+    }
 
-    int num_iterations = 10;
+    int alg_type = atoi(argv[optind+2]);
+    if (strcmp(argv[optind+2], "best") == 0)
+        alg_type = flt_best_alg(A, n);
     
-    assert((alg_type == 0) || (alg_type == 1));
-
-    if (alg_type == 0) {
-        qsort_serial(A, n, num_iterations);
-    } else if (alg_type == 1) {    
-        inline_qsort_serial(A, n, num_iterations);
+    if (strcmp(argv[optind+2], "tune") == 0) {
+        flt_tune(n);
+    } else {
+        assert((alg_type >= 0) && (alg_type <= 6));
+        sort_alg(alg_type, A, n, num_iterations, layout);
     }
 
-    free(A);
+    verify_report();
+    numa_report();
+    numa_free(A);
+    arena_free(arena_local());
 
     return 0;
 }
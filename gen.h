@@ -0,0 +1,198 @@
+/* Reproducible, parallel generators for benchmark inputs.
+ *
+ * Random numbers come from Philox4x32-10, a counter-based generator: the
+ * numbers for element i are a pure function of (seed, i), so any chunk of
+ * the input can be generated by any thread, and the result does not depend
+ * on the number of threads or the schedule.  gen_u64(seed, i) and
+ * gen_unit(seed, i) (uniform in [0, 1)) are the two draws everything else
+ * is built from; a generator that needs several numbers per element uses
+ * the counters i, i + n, i + 2n, ... or a different seed.
+ *
+ * gen_zipf_init(&z, V) tabulates the CDF of the Zipf distribution over the
+ * ranks 0..V-1 (rank r has weight 1 / (r+1)) once; gen_zipf(&z, u) maps a
+ * uniform u to a rank by binary search.
+ *
+ * In C++ there are also the string generators for uniq_str
+ * (gen_str_line() writes line i of an input, without the newline, and
+ * returns its length):
+ *
+ *  zipf     words of 3-12 letters, Zipf distributed over a vocabulary
+ *  iri      RDF-like IRIs: one of a few long namespaces, a Zipf distributed
+ *           resource name and one of 16 ids, e.g.
+ *           <http://dbpedia.org/resource/kuzmo/7>
+ *  varlen   random lowercase strings of 1-GEN_STR_MAX letters, log-uniform
+ *           lengths, each repeated about 4 times
+ */
+
+#ifndef _GEN_H
+#define _GEN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#define GEN_STR_ZIPF    0
+#define GEN_STR_IRI     1
+#define GEN_STR_VARLEN  2
+
+#define GEN_STR_MAX     200     /* longest generated line, in bytes */
+#define GEN_ZIPF_VOCAB  (1 << 20)
+
+static uint64_t gen_seed = 123;
+
+/* one Philox4x32 round */
+static inline void gen_philox_round(uint32_t *c, const uint32_t *k) {
+    uint64_t p0 = (uint64_t) 0xD2511F53u * c[0];
+    uint64_t p1 = (uint64_t) 0xCD9E8D57u * c[2];
+    uint32_t c0 = (uint32_t) (p1 >> 32) ^ c[1] ^ k[0];
+    uint32_t c2 = (uint32_t) (p0 >> 32) ^ c[3] ^ k[1];
+    c[1] = (uint32_t) p1;
+    c[3] = (uint32_t) p0;
+    c[0] = c0;
+    c[2] = c2;
+}
+
+/* Philox4x32-10 of the 128-bit counter (ctr, 0) under a 64-bit key */
+static inline void gen_philox(uint64_t key, uint64_t ctr, uint32_t *out) {
+    uint32_t k[2];
+    int r;
+    k[0] = (uint32_t) key;
+    k[1] = (uint32_t) (key >> 32);
+    out[0] = (uint32_t) ctr;
+    out[1] = (uint32_t) (ctr >> 32);
+    out[2] = 0;
+    out[3] = 0;
+    for (r=0; r<10; r++) {
+        gen_philox_round(out, k);
+        k[0] += 0x9E3779B9u;
+        k[1] += 0xBB67AE85u;
+    }
+}
+
+static inline uint64_t gen_u64(uint64_t seed, uint64_t i) {
+    uint32_t out[4];
+    gen_philox(seed, i, out);
+    return ((uint64_t) out[0] << 32) | out[1];
+}
+
+/* uniform in [0, 1), 53 random bits */
+static inline double gen_unit(uint64_t seed, uint64_t i) {
+    return (gen_u64(seed, i) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+typedef struct {
+    int64_t V;
+    double *cdf;
+} gen_zipf_table;
+
+static void gen_zipf_init(gen_zipf_table *z, int64_t V) {
+    int64_t r;
+    double total = 0.0;
+    z->V = (V < 1) ? 1 : V;
+    z->cdf = (double *) malloc(z->V * sizeof(double));
+    if (z->cdf == NULL) {
+        fprintf(stderr, "Error: could not allocate a Zipf table of %lld ranks!\n", (long long) z->V);
+        exit(2);
+    }
+    for (r=0; r<z->V; r++) {
+        total += 1.0 / (double) (r + 1);
+        z->cdf[r] = total;
+    }
+    for (r=0; r<z->V; r++)
+        z->cdf[r] /= total;
+}
+
+static void gen_zipf_free(gen_zipf_table *z) {
+    free(z->cdf);
+    z->cdf = NULL;
+}
+
+/* first rank whose CDF exceeds u */
+static inline int64_t gen_zipf(const gen_zipf_table *z, double u) {
+    int64_t lo = 0, hi = z->V - 1;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (z->cdf[mid] > u)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+#ifdef __cplusplus
+static int gen_str_parse_kind(const char *s) {
+    if (strcmp(s, "iri") == 0)
+        return GEN_STR_IRI;
+    if (strcmp(s, "varlen") == 0)
+        return GEN_STR_VARLEN;
+    if (strcmp(s, "zipf") != 0)
+        fprintf(stderr, "Unknown string generator %s, using zipf\n", s);
+    return GEN_STR_ZIPF;
+}
+
+/* the word of a vocabulary rank: 3-12 letters, a function of the rank */
+static int gen_word(uint64_t seed, int64_t rank, char *out) {
+    uint32_t r[4];
+    gen_philox(seed ^ 0x776f7264ULL, (uint64_t) rank, r);
+    int len = 3 + r[0] % 10;
+    uint64_t bits = ((uint64_t) r[1] << 32) | r[2];
+    int k;
+    for (k=0; k<len; k++) {
+        out[k] = 'a' + bits % 26;
+        bits /= 26;
+    }
+    return len;
+}
+
+static const char *gen_iri_namespaces[] = {
+    "<http://dbpedia.org/resource/",
+    "<http://dbpedia.org/ontology/",
+    "<http://www.w3.org/1999/02/22-rdf-syntax-ns#",
+    "<http://xmlns.com/foaf/0.1/",
+    "<http://www.wikidata.org/entity/statement/",
+    "<http://purl.org/dc/elements/1.1/",
+    "<http://schema.org/",
+    "<http://example.org/catalog/products/electronics/"
+};
+
+#define GEN_IRI_NAMESPACES ((int) (sizeof(gen_iri_namespaces) / sizeof(gen_iri_namespaces[0])))
+
+/* line i of n lines of the given kind; out needs GEN_STR_MAX + 1 bytes */
+static int gen_str_line(int kind, const gen_zipf_table *z, int64_t n, int64_t i, char *out) {
+    int len = 0;
+    if (kind == GEN_STR_ZIPF) {
+        len = gen_word(gen_seed, gen_zipf(z, gen_unit(gen_seed, i)), out);
+    } else if (kind == GEN_STR_IRI) {
+        uint64_t r = gen_u64(gen_seed, i + n);
+        const char *ns = gen_iri_namespaces[r % GEN_IRI_NAMESPACES];
+        len = (int) strlen(ns);
+        memcpy(out, ns, len);
+        len += gen_word(gen_seed, gen_zipf(z, gen_unit(gen_seed, i)), out + len);
+        len += snprintf(out + len, GEN_STR_MAX + 1 - len, "/%u>", (unsigned) ((r >> 32) % 16));
+    } else {
+        /* about n/4 distinct strings, each a function of its id */
+        uint64_t id = gen_u64(gen_seed, i) % (uint64_t) (n / 4 + 1);
+        uint32_t r[4];
+        gen_philox(gen_seed ^ 0x76617231ULL, id, r);
+        len = (int) exp(log((double) GEN_STR_MAX) * (r[0] / 4294967296.0));
+        if (len < 1)
+            len = 1;
+        /* 13 letters from every 64 random bits */
+        uint64_t bits = 0;
+        int k;
+        for (k=0; k<len; k++) {
+            if (k % 13 == 0)
+                bits = gen_u64(gen_seed ^ id, (uint64_t) k);
+            out[k] = 'a' + bits % 26;
+            bits /= 26;
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+#endif
+
+#endif /* _GEN_H */
@@ -0,0 +1,193 @@
+/* Huge page backing for the large input, sort and scratch arrays.
+ *
+ * With 4 KB pages a multi-GB array needs far more TLB entries than the CPU
+ * has, and random accesses (char * into str_array, merge passes over 10^9
+ * floats) miss the TLB on nearly every load.  huge_map() backs a mapping
+ * with larger pages according to the -H mode:
+ *
+ *  off      plain 4 KB pages
+ *  thp      a 2 MB aligned mapping advised with MADV_HUGEPAGE, so the
+ *           kernel can use transparent huge pages (the default)
+ *  hugetlb  pages from the hugetlbfs pool: 1 GB for mappings of at least
+ *           1 GB, else 2 MB.  If the pool is empty, this falls back to 1 GB
+ *           -> 2 MB -> thp.
+ *
+ * Mappings below HUGE_PAGE_2M bytes always use small pages.  What the
+ * kernel really gave is only known once the pages are touched:
+ * huge_page_desc() reads it from /proc/self/smaps and returns "4k", "2M",
+ * "1G" or "2M-thp" (when some of the range is backed by THP).
+ *
+ * huge_alloc()/huge_free() wrap huge_map()/huge_unmap() for arrays whose
+ * mapped length the caller does not want to track.
+ */
+
+#ifndef _HUGEPAGE_H
+#define _HUGEPAGE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define HUGE_OFF        0
+#define HUGE_THP        1
+#define HUGE_TLB        2
+
+#define HUGE_PAGE_2M    ((size_t) 2 << 20)
+#define HUGE_PAGE_1G    ((size_t) 1 << 30)
+
+#define HUGE_MAX_ALLOCS 64
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
+
+static struct {
+    int mode;
+    int warned;
+    void *alloc_ptr[HUGE_MAX_ALLOCS];
+    size_t alloc_len[HUGE_MAX_ALLOCS];
+} huge = { HUGE_THP, 0, { NULL }, { 0 } };
+
+static int huge_parse_mode(const char *s) {
+    if (strcmp(s, "off") == 0)
+        return HUGE_OFF;
+    if (strcmp(s, "hugetlb") == 0)
+        return HUGE_TLB;
+    if (strcmp(s, "thp") != 0)
+        fprintf(stderr, "Unknown huge page mode %s, using thp\n", s);
+    return HUGE_THP;
+}
+
+static void *huge_map_plain(size_t len) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+#ifdef MAP_HUGETLB
+static void *huge_map_tlb(size_t len, int log2_page) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (log2_page << MAP_HUGE_SHIFT), -1, 0);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+#endif
+
+/* maps at least bytes; *len receives the length to pass to huge_unmap() */
+static void *huge_map(size_t bytes, size_t *len) {
+    void *p = NULL;
+    if (bytes == 0)
+        bytes = 1;
+
+#ifdef MAP_HUGETLB
+    if (huge.mode == HUGE_TLB && bytes >= HUGE_PAGE_2M) {
+        if (bytes >= HUGE_PAGE_1G) {
+            *len = (bytes + HUGE_PAGE_1G - 1) & ~(HUGE_PAGE_1G - 1);
+            p = huge_map_tlb(*len, 30);
+        }
+        if (p == NULL) {
+            *len = (bytes + HUGE_PAGE_2M - 1) & ~(HUGE_PAGE_2M - 1);
+            p = huge_map_tlb(*len, 21);
+        }
+        if (p != NULL)
+            return p;
+        if (!huge.warned) {
+            fprintf(stderr, "No hugetlbfs pages available (see /proc/sys/vm/nr_hugepages), using thp\n");
+            huge.warned = 1;
+        }
+    }
+#endif
+
+    if (huge.mode != HUGE_OFF && bytes >= HUGE_PAGE_2M) {
+        /* over-map, then trim to a 2 MB aligned range the kernel can back
+           with whole huge pages */
+        *len = (bytes + HUGE_PAGE_2M - 1) & ~(HUGE_PAGE_2M - 1);
+        char *raw = (char *) huge_map_plain(*len + HUGE_PAGE_2M);
+        if (raw != NULL) {
+            char *aligned = (char *) (((uintptr_t) raw + HUGE_PAGE_2M - 1) & ~(HUGE_PAGE_2M - 1));
+            if (aligned > raw)
+                munmap(raw, aligned - raw);
+            munmap(aligned + *len, raw + HUGE_PAGE_2M - aligned);
+#ifdef MADV_HUGEPAGE
+            madvise(aligned, *len, MADV_HUGEPAGE);
+#endif
+            return aligned;
+        }
+    }
+
+    *len = bytes;
+    p = huge_map_plain(*len);
+    if (p == NULL) {
+        fprintf(stderr, "Error: could not map %zu bytes!\n", bytes);
+        exit(2);
+    }
+    return p;
+}
+
+static void huge_unmap(void *p, size_t len) {
+    munmap(p, len);
+}
+
+static void *huge_alloc(size_t bytes) {
+    size_t len;
+    void *p = huge_map(bytes, &len);
+    int i;
+    for (i=0; i<HUGE_MAX_ALLOCS; i++) {
+        if (huge.alloc_ptr[i] == NULL) {
+            huge.alloc_ptr[i] = p;
+            huge.alloc_len[i] = len;
+            return p;
+        }
+    }
+    fprintf(stderr, "Error: more than %d huge_alloc() arrays!\n", HUGE_MAX_ALLOCS);
+    exit(2);
+}
+
+static void huge_free(void *p) {
+    int i;
+    for (i=0; i<HUGE_MAX_ALLOCS; i++) {
+        if (huge.alloc_ptr[i] == p) {
+            huge_unmap(p, huge.alloc_len[i]);
+            huge.alloc_ptr[i] = NULL;
+            return;
+        }
+    }
+}
+
+/* page size backing the mapping that contains p, once it has been touched */
+static const char *huge_page_desc(const void *p) {
+    static char desc[32];
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if (fp == NULL)
+        return "unknown";
+
+    char line[256];
+    int in_range = 0;
+    long long kernel_kb = 4, thp_kb = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long long lo, hi;
+        long long v;
+        if (sscanf(line, "%llx-%llx ", &lo, &hi) == 2 && strchr(line, '-') < strchr(line, ' ')) {
+            if (in_range)
+                break;
+            in_range = ((uintptr_t) p >= lo && (uintptr_t) p < hi);
+        } else if (in_range && sscanf(line, "KernelPageSize: %lld kB", &v) == 1) {
+            kernel_kb = v;
+        } else if (in_range && sscanf(line, "AnonHugePages: %lld kB", &v) == 1) {
+            thp_kb = v;
+        }
+    }
+    fclose(fp);
+
+    if (kernel_kb >= (1 << 20))
+        snprintf(desc, sizeof(desc), "%lldG", kernel_kb >> 20);
+    else if (kernel_kb >= 1024)
+        snprintf(desc, sizeof(desc), "%lldM", kernel_kb >> 10);
+    else if (thp_kb > 0)
+        snprintf(desc, sizeof(desc), "2M-thp");
+    else
+        snprintf(desc, sizeof(desc), "%lldk", kernel_kb);
+    return desc;
+}
+
+#endif /* _HUGEPAGE_H */
@@ -0,0 +1,189 @@
+/* In-line, stable, bottom-up merge sort.
+ *
+ * Like QSORT() in qsort.h this is a macro, so every use is compiled into a
+ * kernel specialised for its element type with the comparison inlined.  It
+ * works from both C (flt_val_sort.c) and C++ (uniq_str.cc).
+ *
+ * Usage:
+ *  #include "msort.h"
+ *  #define islt(a,b) (strcmp((*a),(*b))<0)
+ *  char *arr[], *tmp[];
+ *  MSORT(char*, arr, n, islt, tmp);
+ *
+ * The arguments are:
+ *  MSORT(TYPE,BASE,NELT,ISLT,TMP)
+ *  1) type of each element, TYPE,
+ *  2) address of the beginning of the array, of type TYPE*,
+ *  3) number of elements in the array,
+ *  4) comparison routine, receiving pointers to two elements, as in QSORT(),
+ *  5) scratch space for NELT elements of type TYPE.
+ *
+ * Records can also be ordered by a key extracted from each element:
+ *  #define score_key(e) ((e)->score)
+ *  MSORT_BY_KEY(struct rec, recs, n, score_key, tmp);
+ *
+ * A second array can be carried along, every element of it moved wherever
+ * its partner in BASE moves (keys in one array, their values in another):
+ *  MSORT_PAIRED(float, keys, n, islt, tmp_keys, int, vals, tmp_vals);
+ * with scratch space tmp_vals for NELT elements of the second type.
+ *
+ * In C++ there is also msort(base, n, tmp, less) for any functor less(x, y).
+ *
+ * The sort is stable: equal elements keep their order.  Runs of MSORT_LEAF
+ * elements are sorted by insertion sort, then merged pairwise, alternating
+ * between BASE and TMP.  Two runs that are already in order are copied
+ * without comparing their elements, so sorted input costs one comparison
+ * per run.  With OpenMP, arrays of at least MSORT_PARALLEL_CUTOFF elements
+ * sort their leaves and the merges of each pass in parallel.
+ *
+ * Tuning knobs, which can be defined before including this file:
+ *  MSORT_LEAF             elements per insertion-sorted leaf
+ *  MSORT_PARALLEL_CUTOFF  smallest array sorted with several threads
+ */
+
+#ifndef _MSORT_H
+#define _MSORT_H
+
+#include <stddef.h>
+#include <string.h>
+
+#ifndef MSORT_LEAF
+#define MSORT_LEAF 16
+#endif
+
+#ifndef MSORT_PARALLEL_CUTOFF
+#define MSORT_PARALLEL_CUTOFF 65536
+#endif
+
+#define _MSORT_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#ifdef _OPENMP
+#define _MSORT_PARALLEL_FOR \
+  _Pragma("omp parallel for schedule(static) if(_ms_n >= MSORT_PARALLEL_CUTOFF)")
+#else
+#define _MSORT_PARALLEL_FOR
+#endif
+
+/* the two ways of ordering elements: a comparison routine or a key */
+#define _MSORT_LT_PLAIN(ISLT, a, b) ISLT(a, b)
+#define _MSORT_LT_KEY(KEY, a, b) (KEY(a) < KEY(b))
+
+/* the statements moving the second array, kept or dropped */
+#define _MSORT_PAIR_ON(...) __VA_ARGS__
+#define _MSORT_PAIR_OFF(...)
+
+#define MSORT(MSORT_TYPE,MSORT_BASE,MSORT_NELT,MSORT_LT,MSORT_TMP)		\
+  _MSORT_IMPL(MSORT_TYPE, MSORT_BASE, MSORT_NELT, _MSORT_LT_PLAIN, MSORT_LT, MSORT_TMP, \
+              char, NULL, NULL, _MSORT_PAIR_OFF)
+
+#define MSORT_BY_KEY(MSORT_TYPE,MSORT_BASE,MSORT_NELT,MSORT_KEY,MSORT_TMP)	\
+  _MSORT_IMPL(MSORT_TYPE, MSORT_BASE, MSORT_NELT, _MSORT_LT_KEY, MSORT_KEY, MSORT_TMP, \
+              char, NULL, NULL, _MSORT_PAIR_OFF)
+
+#define MSORT_PAIRED(MSORT_TYPE,MSORT_BASE,MSORT_NELT,MSORT_LT,MSORT_TMP,	\
+                     MSORT_VTYPE,MSORT_VBASE,MSORT_VTMP)			\
+  _MSORT_IMPL(MSORT_TYPE, MSORT_BASE, MSORT_NELT, _MSORT_LT_PLAIN, MSORT_LT, MSORT_TMP, \
+              MSORT_VTYPE, MSORT_VBASE, MSORT_VTMP, _MSORT_PAIR_ON)
+
+#define _MSORT_IMPL(MSORT_TYPE,MSORT_BASE,MSORT_NELT,_MS_CMP,_MS_ARG,MSORT_TMP,	\
+                    MSORT_VTYPE,MSORT_VBASE,MSORT_VTMP,_MS_PAIR)		\
+do {								\
+  MSORT_TYPE *const _ms_base = (MSORT_BASE);				\
+  MSORT_TYPE *const _ms_tmp = (MSORT_TMP);				\
+  const size_t _ms_n = (MSORT_NELT);					\
+  MSORT_TYPE *_ms_src = _ms_base;					\
+  MSORT_TYPE *_ms_dst = _ms_tmp;					\
+  _MS_PAIR(MSORT_VTYPE *const _ms_vbase = (MSORT_VBASE);)		\
+  _MS_PAIR(MSORT_VTYPE *_ms_vsrc = _ms_vbase;)				\
+  _MS_PAIR(MSORT_VTYPE *_ms_vdst = (MSORT_VTMP);)			\
+  size_t _ms_w;								\
+  long long _ms_i;							\
+									\
+  /* Insertion sort of the leaves.  Only strictly smaller elements	\
+     are moved past, which keeps equal elements in order. */		\
+  _MSORT_PARALLEL_FOR							\
+  for (_ms_i = 0; _ms_i < (long long) _ms_n; _ms_i += MSORT_LEAF) {	\
+    MSORT_TYPE *const _lo = _ms_base + _ms_i;				\
+    _MS_PAIR(MSORT_VTYPE *const _vlo = _ms_vbase + _ms_i;)		\
+    const size_t _len = _MSORT_MIN((size_t) MSORT_LEAF, _ms_n - _ms_i);	\
+    size_t _j;								\
+    for (_j = 1; _j < _len; _j++) {					\
+      MSORT_TYPE _hold = _lo[_j];					\
+      _MS_PAIR(MSORT_VTYPE _vhold = _vlo[_j];)				\
+      size_t _k = _j;							\
+      while (_k > 0 && _MS_CMP(_MS_ARG, &_hold, &_lo[_k-1])) {		\
+        _lo[_k] = _lo[_k-1];						\
+        _MS_PAIR(_vlo[_k] = _vlo[_k-1];)				\
+        _k--;								\
+      }									\
+      _lo[_k] = _hold;							\
+      _MS_PAIR(_vlo[_k] = _vhold;)					\
+    }									\
+  }									\
+									\
+  /* Merge runs of width _ms_w pairwise from _ms_src into _ms_dst.	\
+     On ties the left run goes first. */				\
+  for (_ms_w = MSORT_LEAF; _ms_w < _ms_n; _ms_w *= 2) {			\
+    _MSORT_PARALLEL_FOR							\
+    for (_ms_i = 0; _ms_i < (long long) _ms_n; _ms_i += 2 * _ms_w) {	\
+      const size_t _mid = _MSORT_MIN(_ms_i + _ms_w, _ms_n);		\
+      const size_t _hi = _MSORT_MIN(_ms_i + 2 * _ms_w, _ms_n);		\
+      MSORT_TYPE *_l = _ms_src + _ms_i;					\
+      MSORT_TYPE *const _l_end = _ms_src + _mid;			\
+      MSORT_TYPE *_r = _l_end;						\
+      MSORT_TYPE *const _r_end = _ms_src + _hi;				\
+      MSORT_TYPE *_out = _ms_dst + _ms_i;				\
+      _MS_PAIR(MSORT_VTYPE *_vl = _ms_vsrc + _ms_i;)			\
+      _MS_PAIR(MSORT_VTYPE *_vr = _ms_vsrc + _mid;)			\
+      _MS_PAIR(MSORT_VTYPE *_vout = _ms_vdst + _ms_i;)			\
+									\
+      if (_r == _r_end || !_MS_CMP(_MS_ARG, _r, (_l_end - 1))) {	\
+        /* already in order */						\
+        memcpy(_out, _l, (_hi - _ms_i) * sizeof(MSORT_TYPE));		\
+        _MS_PAIR(memcpy(_vout, _vl, (_hi - _ms_i) * sizeof(MSORT_VTYPE));) \
+      } else {								\
+        while (_l < _l_end && _r < _r_end) {				\
+          if (_MS_CMP(_MS_ARG, _r, _l)) {				\
+            _MS_PAIR(*_vout++ = *_vr++;)				\
+            *_out++ = *_r++;						\
+          } else {							\
+            _MS_PAIR(*_vout++ = *_vl++;)				\
+            *_out++ = *_l++;						\
+          }								\
+        }								\
+        while (_l < _l_end) {						\
+          _MS_PAIR(*_vout++ = *_vl++;)					\
+          *_out++ = *_l++;						\
+        }								\
+        while (_r < _r_end) {						\
+          _MS_PAIR(*_vout++ = *_vr++;)					\
+          *_out++ = *_r++;						\
+        }								\
+      }									\
+    }									\
+    {									\
+      MSORT_TYPE *const _swap = _ms_src;				\
+      _ms_src = _ms_dst;						\
+      _ms_dst = _swap;							\
+    }									\
+    _MS_PAIR({ MSORT_VTYPE *const _vswap = _ms_vsrc;			\
+               _ms_vsrc = _ms_vdst;					\
+               _ms_vdst = _vswap; })					\
+  }									\
+									\
+  if (_ms_src != _ms_base) {						\
+    memcpy(_ms_base, _ms_src, _ms_n * sizeof(MSORT_TYPE));		\
+    _MS_PAIR(memcpy(_ms_vbase, _ms_vsrc, _ms_n * sizeof(MSORT_VTYPE));) \
+  }									\
+} while (0)
+
+#ifdef __cplusplus
+template <class T, class Less>
+static inline void msort(T *base, size_t n, T *tmp, Less less) {
+#define _MSORT_FUNCTOR_LT(a, b) less(*(a), *(b))
+    MSORT(T, base, n, _MSORT_FUNCTOR_LT, tmp);
+#undef _MSORT_FUNCTOR_LT
+}
+#endif
+
+#endif /* _MSORT_H */
@@ -0,0 +1,235 @@
+/* NUMA placement for the large input and scratch arrays.
+ *
+ * By default the kernel puts a page on the node of the thread that first
+ * writes it, and both programs fill their input on the main thread, so
+ * everything ends up on one socket.  numa_init() selects a policy that
+ * numa_place() then applies to each new mapping:
+ *
+ *  default      leave placement to the kernel
+ *  firsttouch   touch the pages from the worker threads with the same
+ *               static schedule the parallel loops use, so each thread's
+ *               share of the array is local to it
+ *  interleave   spread the pages round-robin over all online nodes (mbind)
+ *
+ * numa_alloc_array() maps memory (with huge pages, see hugepage.h) and
+ * places it; the arena places its
+ * chunks the same way.  A chunk mapped inside a parallel region is touched
+ * by its own thread only, so per-thread scratch stays on that thread's
+ * socket under firsttouch.
+ *
+ * numa_report_pages() prints on which nodes an array's pages landed
+ * (sampled with move_pages), and numa_report() the change in every node's
+ * numastat counters (system wide) since numa_init().  Everything degrades
+ * to plain mmap on systems without NUMA support.
+ */
+
+#ifndef _NUMA_PLACE_H
+#define _NUMA_PLACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "hugepage.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#define NUMA_DEFAULT        0
+#define NUMA_FIRST_TOUCH    1
+#define NUMA_INTERLEAVE     2
+
+#define NUMA_MAX_NODES      64
+#define NUMA_SAMPLE_PAGES   1024
+
+#define NUMA_NUM_STATS      4
+
+static const char *numa_stat_names[NUMA_NUM_STATS] = {
+    "numa_hit", "numa_miss", "local_node", "other_node"
+};
+
+static struct {
+    int policy;
+    int num_nodes;                  /* highest online node + 1 */
+    unsigned long online;           /* bit mask of online nodes */
+    int64_t stats0[NUMA_MAX_NODES][NUMA_NUM_STATS];
+} numa;
+
+static int numa_parse_policy(const char *s) {
+    if (strcmp(s, "firsttouch") == 0)
+        return NUMA_FIRST_TOUCH;
+    if (strcmp(s, "interleave") == 0)
+        return NUMA_INTERLEAVE;
+    if (strcmp(s, "default") != 0)
+        fprintf(stderr, "Unknown NUMA policy %s, using default\n", s);
+    return NUMA_DEFAULT;
+}
+
+static void numa_read_stats(int node, int64_t *stats) {
+    char path[64], name[32];
+    long long v;
+    int i;
+    for (i=0; i<NUMA_NUM_STATS; i++)
+        stats[i] = 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/numastat", node);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return;
+    while (fscanf(fp, "%31s %lld", name, &v) == 2) {
+        for (i=0; i<NUMA_NUM_STATS; i++) {
+            if (strcmp(name, numa_stat_names[i]) == 0)
+                stats[i] = v;
+        }
+    }
+    fclose(fp);
+}
+
+static void numa_init(int policy) {
+    numa.policy = policy;
+    numa.num_nodes = 1;
+    numa.online = 1;
+
+    /* online nodes, as a list like "0-1" */
+    FILE *fp = fopen("/sys/devices/system/node/online", "r");
+    if (fp != NULL) {
+        int lo, hi, c;
+        numa.online = 0;
+        while (fscanf(fp, "%d", &lo) == 1) {
+            hi = lo;
+            c = fgetc(fp);
+            if (c == '-') {
+                if (fscanf(fp, "%d", &hi) != 1)
+                    break;
+                c = fgetc(fp);
+            }
+            for (; lo <= hi && lo < NUMA_MAX_NODES; lo++) {
+                numa.online |= 1UL << lo;
+                numa.num_nodes = lo + 1;
+            }
+            if (c != ',')
+                break;
+        }
+        fclose(fp);
+    }
+
+    int node;
+    for (node=0; node<numa.num_nodes; node++)
+        numa_read_stats(node, numa.stats0[node]);
+
+    if (policy != NUMA_DEFAULT) {
+        int n = 0;
+        for (node=0; node<numa.num_nodes; node++)
+            n += (numa.online >> node) & 1;
+        fprintf(stderr, "NUMA policy %s over %d node(s)\n",
+                (policy == NUMA_INTERLEAVE) ? "interleave" : "firsttouch", n);
+    }
+}
+
+/* applies the policy to fresh, untouched pages */
+static void numa_place(void *p, size_t bytes) {
+    const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    if (numa.policy == NUMA_INTERLEAVE) {
+#ifdef __linux__
+        uintptr_t lo = (uintptr_t) p & ~(page - 1);
+        uintptr_t hi = ((uintptr_t) p + bytes + page - 1) & ~(page - 1);
+        unsigned long mask = numa.online;
+        if (syscall(__NR_mbind, lo, hi - lo, MPOL_INTERLEAVE, &mask,
+                    (unsigned long) NUMA_MAX_NODES + 1, 0) != 0)
+            fprintf(stderr, "mbind(MPOL_INTERLEAVE) failed, using default placement\n");
+#endif
+    } else if (numa.policy == NUMA_FIRST_TOUCH) {
+        char *c = (char *) p;
+        int64_t num_pages = (int64_t) ((bytes + page - 1) / page);
+        int64_t i;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (i=0; i<num_pages; i++)
+            c[i * page] = 0;
+    }
+}
+
+static void *numa_alloc_array(size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        fprintf(stderr, "Error: allocation of %zu x %zu bytes overflows!\n", count, size);
+        exit(2);
+    }
+    size_t bytes = count * size;
+    void *p = huge_alloc(bytes);
+    numa_place(p, bytes);
+    return p;
+}
+
+static void numa_free(void *p) {
+    huge_free(p);
+}
+
+/* node of up to NUMA_SAMPLE_PAGES evenly spaced pages of [p, p + bytes) */
+static void numa_report_pages(const char *label, const void *p, size_t bytes) {
+#ifdef __linux__
+    if (numa.num_nodes < 2 && numa.policy == NUMA_DEFAULT)
+        return;
+    const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t num_pages = (bytes + page - 1) / page;
+    size_t step = (num_pages + NUMA_SAMPLE_PAGES - 1) / NUMA_SAMPLE_PAGES;
+    void *pages[NUMA_SAMPLE_PAGES];
+    int status[NUMA_SAMPLE_PAGES];
+    size_t n = 0, i;
+    if (step == 0)
+        return;
+    for (i=0; i<num_pages && n<NUMA_SAMPLE_PAGES; i+=step)
+        pages[n++] = (void *) (((uintptr_t) p & ~(page - 1)) + i * page);
+    if (syscall(__NR_move_pages, 0, n, pages, NULL, status, 0) != 0)
+        return;
+
+    int64_t per_node[NUMA_MAX_NODES];
+    int64_t unmapped = 0;
+    memset(per_node, 0, sizeof(per_node));
+    for (i=0; i<n; i++) {
+        if (status[i] >= 0 && status[i] < NUMA_MAX_NODES)
+            per_node[status[i]]++;
+        else
+            unmapped++;
+    }
+    fprintf(stderr, "%s pages per node (%zu sampled):", label, n);
+    int node;
+    for (node=0; node<numa.num_nodes; node++)
+        fprintf(stderr, " %d:%.1f%%", node, 100.0 * per_node[node] / n);
+    if (unmapped > 0)
+        fprintf(stderr, " untouched:%.1f%%", 100.0 * unmapped / n);
+    fprintf(stderr, "\n");
+#else
+    (void) label;
+    (void) p;
+    (void) bytes;
+#endif
+}
+
+static void numa_report(void) {
+    if (numa.num_nodes < 2 && numa.policy == NUMA_DEFAULT)
+        return;
+    fprintf(stderr, "NUMA allocations per node since start (system wide, pages):\n");
+    fprintf(stderr, "%-6s", "node");
+    int node, i;
+    for (i=0; i<NUMA_NUM_STATS; i++)
+        fprintf(stderr, " %12s", numa_stat_names[i]);
+    fprintf(stderr, "\n");
+    for (node=0; node<numa.num_nodes; node++) {
+        if (!((numa.online >> node) & 1))
+            continue;
+        int64_t stats[NUMA_NUM_STATS];
+        numa_read_stats(node, stats);
+        fprintf(stderr, "%-6d", node);
+        for (i=0; i<NUMA_NUM_STATS; i++)
+            fprintf(stderr, " %12lld", (long long) (stats[i] - numa.stats0[node][i]));
+        fprintf(stderr, "\n");
+    }
+}
+
+#endif /* _NUMA_PLACE_H */
@@ -0,0 +1,206 @@
+/* Optional hardware performance counters (Linux perf_event_open).
+ *
+ * perf_open() opens one counter per event for the calling process; the
+ * counters are inherited by threads created afterwards, so call it before
+ * the first OpenMP parallel region.  Counters that the CPU or the kernel
+ * (see /proc/sys/kernel/perf_event_paranoid) does not provide are skipped
+ * and reported as n/a; if none can be opened, or on other systems, every
+ * call below is a no-op.
+ *
+ * The counters run freely.  A perf_phases object reads them at phase
+ * boundaries and accumulates the differences per named phase:
+ *
+ *  perf_phases_init(&pp);
+ *  for (iter...) {
+ *      perf_begin(&pp);
+ *      sort(...);
+ *      perf_phase(&pp, "sort");
+ *      count(...);
+ *      perf_phase(&pp, "count");
+ *      perf_end_iteration(&pp, n);   // totals + one line per iteration
+ *  }
+ *  perf_summary(&pp, n);             // per phase averages
+ */
+
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#define PERF_CYCLES         0
+#define PERF_INSTRUCTIONS   1
+#define PERF_BRANCH_MISSES  2
+#define PERF_LLC_MISSES     3
+#define PERF_DTLB_MISSES    4
+#define PERF_NUM_EVENTS     5
+
+#define PERF_MAX_PHASES     8
+
+typedef struct {
+    double v[PERF_NUM_EVENTS];
+} perf_sample;
+
+typedef struct {
+    int enabled;
+    int fd[PERF_NUM_EVENTS];
+} perf_counters;
+
+static perf_counters perf_pc = { 0, { -1, -1, -1, -1, -1 } };
+
+static const char *perf_event_names[PERF_NUM_EVENTS] = {
+    "cycles", "instructions", "branch-misses", "LLC-misses", "dTLB-misses"
+};
+
+#ifdef __linux__
+static int perf_open_event(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void perf_open(void) {
+    int i;
+    for (i=0; i<PERF_NUM_EVENTS; i++)
+        perf_pc.fd[i] = -1;
+    perf_pc.enabled = 0;
+
+#ifdef __linux__
+    const uint64_t cache_read_miss =
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    perf_pc.fd[PERF_CYCLES] = perf_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    perf_pc.fd[PERF_INSTRUCTIONS] = perf_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    perf_pc.fd[PERF_BRANCH_MISSES] = perf_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    perf_pc.fd[PERF_LLC_MISSES] = perf_open_event(PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_LL | cache_read_miss);
+    perf_pc.fd[PERF_DTLB_MISSES] = perf_open_event(PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_DTLB | cache_read_miss);
+
+    for (i=0; i<PERF_NUM_EVENTS; i++) {
+        if (perf_pc.fd[i] >= 0)
+            perf_pc.enabled = 1;
+    }
+#endif
+
+    if (!perf_pc.enabled)
+        fprintf(stderr, "Performance counters unavailable, continuing without them\n");
+}
+
+/* current counter values, scaled up if the kernel had to multiplex them */
+static void perf_read(perf_sample *s) {
+    int i;
+    for (i=0; i<PERF_NUM_EVENTS; i++) {
+        s->v[i] = -1.0;
+#ifdef __linux__
+        uint64_t buf[3];
+        if (perf_pc.fd[i] >= 0 && read(perf_pc.fd[i], buf, sizeof(buf)) == sizeof(buf)) {
+            s->v[i] = (double) buf[0];
+            if (buf[2] > 0 && buf[2] < buf[1])
+                s->v[i] *= (double) buf[1] / (double) buf[2];
+        }
+#endif
+    }
+}
+
+typedef struct {
+    int num_phases;
+    int num_iterations;
+    const char *names[PERF_MAX_PHASES];
+    perf_sample total[PERF_MAX_PHASES];     /* summed over completed iterations */
+    perf_sample cur[PERF_MAX_PHASES];       /* current iteration */
+    perf_sample mark;                       /* counters at the last boundary */
+} perf_phases;
+
+static void perf_phases_init(perf_phases *pp) {
+    memset(pp, 0, sizeof(*pp));
+}
+
+static void perf_begin(perf_phases *pp) {
+    if (!perf_pc.enabled)
+        return;
+    memset(pp->cur, 0, sizeof(pp->cur));
+    perf_read(&pp->mark);
+}
+
+static void perf_phase(perf_phases *pp, const char *name) {
+    if (!perf_pc.enabled)
+        return;
+    perf_sample now;
+    perf_read(&now);
+
+    int p;
+    for (p=0; p<pp->num_phases; p++) {
+        if (strcmp(pp->names[p], name) == 0)
+            break;
+    }
+    if (p == pp->num_phases) {
+        if (p == PERF_MAX_PHASES)
+            return;
+        pp->names[p] = name;
+        pp->num_phases++;
+    }
+
+    int i;
+    for (i=0; i<PERF_NUM_EVENTS; i++)
+        pp->cur[p].v[i] += (now.v[i] >= 0.0) ? now.v[i] - pp->mark.v[i] : -1.0;
+    pp->mark = now;
+}
+
+static void perf_print(const char *label, const perf_sample *s, double scale, double n) {
+    fprintf(stderr, "%-10s", label);
+    int i;
+    for (i=0; i<PERF_NUM_EVENTS; i++) {
+        if (s->v[i] < 0.0)
+            fprintf(stderr, " %s n/a", perf_event_names[i]);
+        else if (i == PERF_CYCLES || i == PERF_INSTRUCTIONS)
+            fprintf(stderr, " %s %.4g", perf_event_names[i], s->v[i] * scale);
+        else
+            fprintf(stderr, " %s/elt %.4f", perf_event_names[i], s->v[i] * scale / n);
+    }
+    if (s->v[PERF_CYCLES] > 0.0 && s->v[PERF_INSTRUCTIONS] >= 0.0)
+        fprintf(stderr, " IPC %.3f", s->v[PERF_INSTRUCTIONS] / s->v[PERF_CYCLES]);
+    fprintf(stderr, "\n");
+}
+
+/* adds the current iteration to the totals; skip it for warm-up runs */
+static void perf_end_iteration(perf_phases *pp, double n) {
+    if (!perf_pc.enabled)
+        return;
+    perf_sample sum;
+    memset(&sum, 0, sizeof(sum));
+    int p, i;
+    for (p=0; p<pp->num_phases; p++) {
+        for (i=0; i<PERF_NUM_EVENTS; i++) {
+            pp->total[p].v[i] += pp->cur[p].v[i];
+            sum.v[i] += pp->cur[p].v[i];
+        }
+    }
+    pp->num_iterations++;
+    perf_print("  counters", &sum, 1.0, n);
+}
+
+static void perf_summary(const perf_phases *pp, double n) {
+    if (!perf_pc.enabled || pp->num_iterations == 0)
+        return;
+    fprintf(stderr, "Average counters per iteration and phase:\n");
+    int p;
+    for (p=0; p<pp->num_phases; p++)
+        perf_print(pp->names[p], &pp->total[p], 1.0 / pp->num_iterations, n);
+}
+
+#endif /* _PERF_COUNTERS_H */
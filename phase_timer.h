@@ -0,0 +1,167 @@
+/* Per-phase wall and CPU time for the uniq_str pipeline.
+ *
+ * A scoped_phase charges the time between its construction and its
+ * destruction (or stop()) to one phase of the calling thread; next() closes
+ * the current phase and opens another, so consecutive phases need no extra
+ * scopes:
+ *
+ *  scoped_phase phase(PHASE_SORT);
+ *  sort(...);
+ *  phase.next(PHASE_COUNT);
+ *  count(...);
+ *  phase.stop();
+ *
+ * A phase opened outside any parallel region spans the parallel regions
+ * run inside it, so it is charged the CPU time of the whole process; that
+ * is the phase's row in the summary.  A phase opened inside a parallel
+ * region (a thread's share of a sort pass, a count partition) is charged
+ * its thread's CPU time, in a separate table, which gives the per-thread
+ * breakdown under the row:
+ *
+ *  scoped_phase phase(PHASE_SORT);
+ *  #pragma omp parallel
+ *  {
+ *      scoped_phase thread_phase(PHASE_SORT);
+ *      #pragma omp for
+ *      ...
+ *  }
+ *
+ * Each thread owns a cache line per phase, so recording needs no locks and
+ * costs two clock reads per boundary.  phase_report() prints the summary
+ * table, with the breakdown for phases that ran on several threads.
+ */
+
+#ifndef _PHASE_TIMER_H
+#define _PHASE_TIMER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+enum {
+    PHASE_LOAD,
+    PHASE_TOKENIZE,
+    PHASE_SORT,
+    PHASE_COUNT,
+    PHASE_FIXUP,
+    PHASE_VERIFY,
+    PHASE_OUTPUT,
+    NUM_PHASES
+};
+
+static const char *phase_names[NUM_PHASES] = {
+    "load", "tokenize", "sort", "count", "fixup", "verify", "output"
+};
+
+#define PHASE_MAX_THREADS 256
+
+struct phase_slot {
+    double wall;
+    double cpu;
+    int64_t calls;
+    char pad[64 - 2 * sizeof(double) - sizeof(int64_t)];
+};
+
+static phase_slot phase_total[NUM_PHASES];                      /* outside parallel regions */
+static phase_slot phase_table[PHASE_MAX_THREADS][NUM_PHASES];   /* inside, per thread */
+
+static inline double phase_clock(clockid_t clock) {
+    struct timespec tp;
+    clock_gettime(clock, &tp);
+    return ((double) (tp.tv_sec) + 1e-9 * tp.tv_nsec);
+}
+
+class scoped_phase {
+    public:
+        explicit scoped_phase(int phase) {
+            /* a level counts inactive (one thread, nested) regions too */
+            worker = 0;
+            tid = 0;
+#ifdef _OPENMP
+            if (omp_get_level() > 0) {
+                worker = 1;
+                tid = omp_get_thread_num();
+                if (tid >= PHASE_MAX_THREADS)
+                    tid = PHASE_MAX_THREADS - 1;
+            }
+#endif
+            cpu_clock = worker ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID;
+            start(phase);
+        }
+        ~scoped_phase() {
+            stop();
+        }
+        void next(int phase) {
+            stop();
+            start(phase);
+        }
+        void stop() {
+            if (curr < 0)
+                return;
+            phase_slot *slot = worker ? &phase_table[tid][curr] : &phase_total[curr];
+            slot->wall += phase_clock(CLOCK_MONOTONIC) - wall0;
+            slot->cpu += phase_clock(cpu_clock) - cpu0;
+            slot->calls++;
+            curr = -1;
+        }
+    private:
+        void start(int phase) {
+            curr = phase;
+            wall0 = phase_clock(CLOCK_MONOTONIC);
+            cpu0 = phase_clock(cpu_clock);
+        }
+        int worker;
+        int tid;
+        clockid_t cpu_clock;
+        int curr;
+        double wall0;
+        double cpu0;
+};
+
+static void phase_report() {
+    fprintf(stderr, "Phase breakdown (totals over all runs):\n");
+    fprintf(stderr, "%-10s %8s %12s %12s %8s\n", "phase", "calls", "wall ms", "cpu ms", "threads");
+
+    int p, t;
+    for (p=0; p<NUM_PHASES; p++) {
+        double wall = 0.0, cpu = 0.0;
+        int64_t calls = 0;
+        int threads = 0;
+        for (t=0; t<PHASE_MAX_THREADS; t++) {
+            if (phase_table[t][p].calls == 0)
+                continue;
+            /* threads run concurrently: wall time is the slowest thread's */
+            if (phase_table[t][p].wall > wall)
+                wall = phase_table[t][p].wall;
+            cpu += phase_table[t][p].cpu;
+            calls += phase_table[t][p].calls;
+            threads++;
+        }
+        /* the phase around the parallel regions covers them */
+        if (phase_total[p].calls > 0) {
+            wall = phase_total[p].wall;
+            cpu = phase_total[p].cpu;
+            calls = phase_total[p].calls;
+            if (threads == 0)
+                threads = 1;
+        }
+        if (calls == 0)
+            continue;
+        fprintf(stderr, "%-10s %8lld %12.3lf %12.3lf %8d\n", phase_names[p],
+                (long long) calls, wall*1e3, cpu*1e3, threads);
+        if (threads < 2)
+            continue;
+        for (t=0; t<PHASE_MAX_THREADS; t++) {
+            if (phase_table[t][p].calls == 0)
+                continue;
+            fprintf(stderr, "  thread %-3d%8lld %12.3lf %12.3lf\n", t,
+                    (long long) phase_table[t][p].calls,
+                    phase_table[t][p].wall*1e3, phase_table[t][p].cpu*1e3);
+        }
+    }
+}
+
+#endif /* _PHASE_TIMER_H */
@@ -0,0 +1,275 @@
+/* Persistent, pinned worker threads on top of the OpenMP runtime.
+ *
+ * The OpenMP runtime keeps its thread team alive between parallel regions,
+ * so the team is the pool: pool_init() sizes it, disables nested regions
+ * (an MSORT() inside a parallel loop then runs on the calling thread
+ * instead of oversubscribing the machine) and starts every thread once,
+ * pinning it to a CPU chosen by the affinity policy.  Call it in main
+ * after perf_open(), before anything is timed:
+ *
+ *  pool_init(num_threads, pool_parse_affinity("scatter"));
+ *
+ * Policies, over the CPUs the process may run on:
+ *  none     leave placement to the OS
+ *  compact  fill a core's hyperthreads, then its socket, then the next
+ *  scatter  one thread per socket in turn, hyperthreads last
+ *  node<N>  only the CPUs of NUMA node N, compactly
+ *
+ * Threads that idle between iterations may sleep; export
+ * OMP_WAIT_POLICY=active to keep them spinning during benchmarks.
+ *
+ * In C++ there is also pool_parallel_for(begin, end, grain, body), which
+ * hands out chunks of grain indices to the team dynamically.
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#define POOL_NONE       0
+#define POOL_COMPACT    1
+#define POOL_SCATTER    2
+#define POOL_NODE       3
+
+#define POOL_MAX_CPUS   1024
+
+typedef struct {
+    int policy;
+    int node;
+} pool_affinity;
+
+typedef struct {
+    int cpu;
+    int package;
+    int core;
+    int smt;        /* rank among the hyperthreads of its core */
+    int core_rank;  /* rank of its core within the package */
+} pool_cpu;
+
+static struct {
+    int num_threads;
+    pool_affinity affinity;
+    int num_cpus;
+    pool_cpu order[POOL_MAX_CPUS];  /* CPUs in the order threads take them */
+    int thread_cpu[POOL_MAX_CPUS];
+} pool;
+
+static pool_affinity pool_parse_affinity(const char *s) {
+    pool_affinity a;
+    a.policy = POOL_NONE;
+    a.node = 0;
+    if (strcmp(s, "compact") == 0) {
+        a.policy = POOL_COMPACT;
+    } else if (strcmp(s, "scatter") == 0) {
+        a.policy = POOL_SCATTER;
+    } else if (strncmp(s, "node", 4) == 0) {
+        a.policy = POOL_NODE;
+        a.node = atoi(s + 4);
+    } else if (strcmp(s, "none") != 0) {
+        fprintf(stderr, "Unknown affinity policy %s, using none\n", s);
+    }
+    return a;
+}
+
+static const char *pool_affinity_name(pool_affinity a) {
+    static const char *names[] = { "none", "compact", "scatter", "node" };
+    return names[a.policy];
+}
+
+#ifdef __linux__
+static int pool_read_int(const char *fmt, int cpu) {
+    char path[128];
+    snprintf(path, sizeof(path), fmt, cpu);
+    FILE *fp = fopen(path, "r");
+    int v = 0;
+    if (fp == NULL)
+        return 0;
+    if (fscanf(fp, "%d", &v) != 1)
+        v = 0;
+    fclose(fp);
+    return v;
+}
+
+/* marks the CPUs of a list like "0-3,8-11" in in_list */
+static int pool_read_cpulist(const char *path, char *in_list) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    int lo, hi;
+    while (fscanf(fp, "%d", &lo) == 1) {
+        hi = lo;
+        int c = fgetc(fp);
+        if (c == '-') {
+            if (fscanf(fp, "%d", &hi) != 1)
+                break;
+            c = fgetc(fp);
+        }
+        for (; lo <= hi && lo < POOL_MAX_CPUS; lo++)
+            in_list[lo] = 1;
+        if (c != ',')
+            break;
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int pool_cmp_compact(const void *u, const void *v) {
+    const pool_cpu *a = (const pool_cpu *) u, *b = (const pool_cpu *) v;
+    if (a->package != b->package)
+        return a->package - b->package;
+    if (a->core != b->core)
+        return a->core - b->core;
+    return a->cpu - b->cpu;
+}
+
+static int pool_cmp_scatter(const void *u, const void *v) {
+    const pool_cpu *a = (const pool_cpu *) u, *b = (const pool_cpu *) v;
+    if (a->smt != b->smt)
+        return a->smt - b->smt;
+    if (a->core_rank != b->core_rank)
+        return a->core_rank - b->core_rank;
+    if (a->package != b->package)
+        return a->package - b->package;
+    return a->cpu - b->cpu;
+}
+
+/* fills pool.order with the allowed CPUs in the order of the policy */
+static void pool_topology(pool_affinity a) {
+    unsigned long mask[POOL_MAX_CPUS / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    if (syscall(__NR_sched_getaffinity, 0, sizeof(mask), mask) < 0)
+        return;
+
+    char in_node[POOL_MAX_CPUS];
+    memset(in_node, 1, sizeof(in_node));
+    if (a.policy == POOL_NODE) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", a.node);
+        memset(in_node, 0, sizeof(in_node));
+        if (pool_read_cpulist(path, in_node) < 0)
+            fprintf(stderr, "NUMA node %d not found, no CPUs to pin to\n", a.node);
+    }
+
+    int cpu;
+    pool.num_cpus = 0;
+    for (cpu=0; cpu<POOL_MAX_CPUS; cpu++) {
+        const int bits = 8 * sizeof(unsigned long);
+        if (!((mask[cpu / bits] >> (cpu % bits)) & 1UL) || !in_node[cpu])
+            continue;
+        pool_cpu *c = &pool.order[pool.num_cpus++];
+        c->cpu = cpu;
+        c->package = pool_read_int("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        c->core = pool_read_int("/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+    }
+
+    /* ranks for scatter, from the compact order */
+    qsort(pool.order, pool.num_cpus, sizeof(pool_cpu), pool_cmp_compact);
+    int i;
+    for (i=0; i<pool.num_cpus; i++) {
+        pool_cpu *c = &pool.order[i];
+        pool_cpu *p = (i > 0) ? &pool.order[i-1] : NULL;
+        if (p != NULL && p->package == c->package) {
+            c->smt = (p->core == c->core) ? p->smt + 1 : 0;
+            c->core_rank = (p->core == c->core) ? p->core_rank : p->core_rank + 1;
+        } else {
+            c->smt = 0;
+            c->core_rank = 0;
+        }
+    }
+    if (a.policy == POOL_SCATTER)
+        qsort(pool.order, pool.num_cpus, sizeof(pool_cpu), pool_cmp_scatter);
+}
+
+static int pool_pin(int cpu) {
+    unsigned long mask[POOL_MAX_CPUS / (8 * sizeof(unsigned long))];
+    const int bits = 8 * sizeof(unsigned long);
+    memset(mask, 0, sizeof(mask));
+    mask[cpu / bits] |= 1UL << (cpu % bits);
+    return (int) syscall(__NR_sched_setaffinity, 0, sizeof(mask), mask);
+}
+#endif
+
+static void pool_init(int num_threads, pool_affinity a) {
+    pool.affinity = a;
+    pool.num_threads = 1;
+    pool.num_cpus = 0;
+#ifdef _OPENMP
+    if (num_threads > 0)
+        omp_set_num_threads(num_threads);
+    omp_set_max_active_levels(1);
+    pool.num_threads = omp_get_max_threads();
+    if (pool.num_threads > POOL_MAX_CPUS)
+        pool.num_threads = POOL_MAX_CPUS;
+#else
+    (void) num_threads;
+#endif
+
+#ifdef __linux__
+    if (a.policy != POOL_NONE)
+        pool_topology(a);
+#endif
+
+    /* start the team once, pinning each thread */
+#ifdef _OPENMP
+#pragma omp parallel num_threads(pool.num_threads)
+#endif
+    {
+        int tid = 0;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+#endif
+        pool.thread_cpu[tid] = -1;
+#ifdef __linux__
+        if (pool.num_cpus > 0) {
+            int cpu = pool.order[tid % pool.num_cpus].cpu;
+            if (pool_pin(cpu) == 0)
+                pool.thread_cpu[tid] = cpu;
+        }
+#endif
+    }
+
+    fprintf(stderr, "Thread pool: %d threads, affinity %s", pool.num_threads,
+            pool_affinity_name(a));
+    if (a.policy == POOL_NODE)
+        fprintf(stderr, " %d", a.node);
+    if (a.policy != POOL_NONE) {
+        int t;
+        fprintf(stderr, ", cpus");
+        for (t=0; t<pool.num_threads; t++)
+            fprintf(stderr, " %d", pool.thread_cpu[t]);
+    }
+    fprintf(stderr, "\n");
+}
+
+#ifdef __cplusplus
+template <class F>
+static void pool_parallel_for(int64_t begin, int64_t end, int64_t grain, F body) {
+    if (grain < 1)
+        grain = 1;
+    int64_t num_chunks = (end - begin + grain - 1) / grain;
+    int64_t c;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (c=0; c<num_chunks; c++) {
+        int64_t lo = begin + c * grain;
+        int64_t hi = (lo + grain < end) ? lo + grain : end;
+        int64_t i;
+        for (i=lo; i<hi; i++)
+            body(i);
+    }
+}
+#endif
+
+#endif /* _POOL_H */
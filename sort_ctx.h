@@ -0,0 +1,139 @@
+/* Reusable sort context: all the scratch of one benchmark, sized once.
+ *
+ * A benchmark requests its buffers (the array to sort, its ping-pong
+ * partner, counts, a pristine copy of the prepared input, ...) from the
+ * context during setup, then marks the context ready.  Everything an
+ * iteration allocates on top of that is dropped by sort_ctx_reset(), in
+ * O(1), at the start of the next one:
+ *
+ *  sort_ctx ctx;
+ *  sort_ctx_init(&ctx);
+ *  float *B = (float *) sort_ctx_buffer(&ctx, n, sizeof(float));
+ *  sort_ctx_ready(&ctx);
+ *  for (iter = ...) {
+ *      sort_ctx_reset(&ctx, iter);
+ *      sort_ctx_copy(B, A, n * sizeof(float));
+ *      ...
+ *  }
+ *  sort_ctx_report(&ctx);
+ *  sort_ctx_free(&ctx);
+ *
+ * The context lives in the calling thread's arena (arena.h), which also
+ * holds the merge sort's temporary arrays, so once the warm-up iterations
+ * have grown it the timed iterations map no memory at all.
+ * sort_ctx_report() prints how many arena chunks were mapped during the
+ * timed iterations (any thread), which should be 0.
+ *
+ * sort_ctx_copy() and sort_ctx_zero() replace the per-element copy and
+ * clear loops: they run in parallel over SORT_CTX_CHUNK byte chunks, and
+ * copies of at least SORT_CTX_STREAM_MIN bytes, too large to stay in the
+ * cache anyway, use non-temporal stores.
+ */
+
+#ifndef _SORT_CTX_H
+#define _SORT_CTX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define SORT_CTX_CHUNK      ((size_t) 1 << 20)
+#define SORT_CTX_STREAM_MIN ((size_t) 32 << 20)
+
+typedef struct {
+    arena *a;
+    arena_mark sized;       /* end of the buffers requested during setup */
+    int64_t maps;           /* arena_maps when the timed iterations started */
+} sort_ctx;
+
+static void sort_ctx_init(sort_ctx *ctx) {
+    ctx->a = arena_local();
+    ctx->sized = arena_save(ctx->a);
+    ctx->maps = -1;
+}
+
+static void *sort_ctx_buffer(sort_ctx *ctx, size_t count, size_t size) {
+    return arena_alloc_array(ctx->a, count, size);
+}
+
+static void sort_ctx_ready(sort_ctx *ctx) {
+    ctx->sized = arena_save(ctx->a);
+}
+
+/* drops what the last iteration allocated; iter is the benchmark's
+   iteration number, so the first timed one (0) starts the count of maps */
+static void sort_ctx_reset(sort_ctx *ctx, int iter) {
+    arena_release(ctx->a, ctx->sized);
+    if (iter == 0)
+        ctx->maps = arena_maps;
+}
+
+static void sort_ctx_report(const sort_ctx *ctx) {
+    if (ctx->maps < 0)
+        return;
+    int64_t maps = arena_maps - ctx->maps;
+    fprintf(stderr, "Scratch maps during timed iterations: %lld%s\n", (long long) maps,
+            (maps > 0) ? " (more warm-up iterations would avoid them)" : "");
+}
+
+static void sort_ctx_free(sort_ctx *ctx) {
+    arena_reset(ctx->a);
+}
+
+static void sort_ctx_copy_chunk(char *dst, const char *src, size_t len, int stream) {
+#ifdef __SSE2__
+    if (stream && ((uintptr_t) dst & 15) == 0) {
+        size_t k;
+        for (k=0; k+64<=len; k+=64) {
+            __m128i x0 = _mm_loadu_si128((const __m128i *) (src + k));
+            __m128i x1 = _mm_loadu_si128((const __m128i *) (src + k + 16));
+            __m128i x2 = _mm_loadu_si128((const __m128i *) (src + k + 32));
+            __m128i x3 = _mm_loadu_si128((const __m128i *) (src + k + 48));
+            _mm_stream_si128((__m128i *) (dst + k), x0);
+            _mm_stream_si128((__m128i *) (dst + k + 16), x1);
+            _mm_stream_si128((__m128i *) (dst + k + 32), x2);
+            _mm_stream_si128((__m128i *) (dst + k + 48), x3);
+        }
+        memcpy(dst + k, src + k, len - k);
+        _mm_sfence();
+        return;
+    }
+#else
+    (void) stream;
+#endif
+    memcpy(dst, src, len);
+}
+
+static void sort_ctx_copy(void *dst, const void *src, size_t bytes) {
+    const int stream = (bytes >= SORT_CTX_STREAM_MIN);
+    const int64_t num_chunks = (int64_t) ((bytes + SORT_CTX_CHUNK - 1) / SORT_CTX_CHUNK);
+    int64_t c;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(num_chunks > 1)
+#endif
+    for (c=0; c<num_chunks; c++) {
+        size_t lo = (size_t) c * SORT_CTX_CHUNK;
+        size_t len = (bytes - lo < SORT_CTX_CHUNK) ? bytes - lo : SORT_CTX_CHUNK;
+        sort_ctx_copy_chunk((char *) dst + lo, (const char *) src + lo, len, stream);
+    }
+}
+
+static inline void sort_ctx_zero(void *dst, size_t bytes) {
+    const int64_t num_chunks = (int64_t) ((bytes + SORT_CTX_CHUNK - 1) / SORT_CTX_CHUNK);
+    int64_t c;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(num_chunks > 1)
+#endif
+    for (c=0; c<num_chunks; c++) {
+        size_t lo = (size_t) c * SORT_CTX_CHUNK;
+        size_t len = (bytes - lo < SORT_CTX_CHUNK) ? bytes - lo : SORT_CTX_CHUNK;
+        memset((char *) dst + lo, 0, len);
+    }
+}
+
+#endif /* _SORT_CTX_H */
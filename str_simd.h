@@ -0,0 +1,137 @@
+/* SIMD string comparison for the uniq_str hot loops.
+ *
+ * str_cmp(a, b) orders two NUL-terminated strings like strcmp(): it finds
+ * the index of the first byte that differs or ends either string, 16 bytes
+ * per step with SSE4.2 (PCMPISTRI) or 32 with AVX2, and then compares that
+ * one byte.  str_equal(a, b) only answers equal or not, for the counting
+ * passes that never need the order; it settles strings that differ in
+ * their first byte without a call.  str_equal_hashed() and str_equal_len()
+ * check a cached hash or length first and only read the strings when that
+ * matches.
+ *
+ * The kernel is picked once by str_simd_init() from the CPU features
+ * (__builtin_cpu_supports), so one binary runs everywhere; until then, and
+ * on other compilers or CPUs, str_cmp is strcmp.
+ *
+ * Vector loads may read past the terminating NUL, but never into the next
+ * page: a load that would cross a page boundary is done byte by byte.
+ */
+
+#ifndef _STR_SIMD_H
+#define _STR_SIMD_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define STR_SIMD_PAGE 4096
+
+/* true when a load of width bytes at p would touch the next page */
+#define _STR_CROSSES_PAGE(p, width) \
+    ((((uintptr_t) (p)) & (STR_SIMD_PAGE - 1)) > STR_SIMD_PAGE - (width))
+
+/* compares up to width bytes one at a time; sets *done when it has an answer */
+static inline int str_cmp_bytes(const unsigned char *a, const unsigned char *b,
+        int width, int *done) {
+    int k;
+    for (k=0; k<width; k++) {
+        if (a[k] != b[k] || a[k] == 0) {
+            *done = 1;
+            return a[k] - b[k];
+        }
+    }
+    *done = 0;
+    return 0;
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define STR_SIMD_X86
+#include <immintrin.h>
+
+#define _STR_SSE42_MODE \
+    (_SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_EACH | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT)
+
+__attribute__((target("sse4.2")))
+static int str_cmp_sse42(const char *a, const char *b) {
+    const unsigned char *u = (const unsigned char *) a;
+    const unsigned char *v = (const unsigned char *) b;
+    for (;; u += 16, v += 16) {
+        if (_STR_CROSSES_PAGE(u, 16) || _STR_CROSSES_PAGE(v, 16)) {
+            int done, r = str_cmp_bytes(u, v, 16, &done);
+            if (done)
+                return r;
+            continue;
+        }
+        __m128i x = _mm_loadu_si128((const __m128i *) u);
+        __m128i y = _mm_loadu_si128((const __m128i *) v);
+        /* first index where the bytes differ or exactly one string ended */
+        int idx = _mm_cmpistri(x, y, _STR_SSE42_MODE);
+        if (idx < 16)
+            return u[idx] - v[idx];
+        /* no difference, and b ended in this block: so did a */
+        if (_mm_cmpistrz(x, y, _STR_SSE42_MODE))
+            return 0;
+    }
+}
+
+__attribute__((target("avx2")))
+static int str_cmp_avx2(const char *a, const char *b) {
+    const unsigned char *u = (const unsigned char *) a;
+    const unsigned char *v = (const unsigned char *) b;
+    const __m256i zero = _mm256_setzero_si256();
+    for (;; u += 32, v += 32) {
+        if (_STR_CROSSES_PAGE(u, 32) || _STR_CROSSES_PAGE(v, 32)) {
+            int done, r = str_cmp_bytes(u, v, 32, &done);
+            if (done)
+                return r;
+            continue;
+        }
+        __m256i x = _mm256_loadu_si256((const __m256i *) u);
+        __m256i y = _mm256_loadu_si256((const __m256i *) v);
+        uint32_t diff = ~(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        uint32_t end = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, zero));
+        uint32_t stop = diff | end;
+        if (stop != 0) {
+            int idx = __builtin_ctz(stop);
+            return u[idx] - v[idx];
+        }
+    }
+}
+#endif
+
+static int str_cmp_scalar(const char *a, const char *b) {
+    return strcmp(a, b);
+}
+
+static int (*str_cmp)(const char *, const char *) = str_cmp_scalar;
+static const char *str_simd_name = "scalar";
+
+/* picks the widest kernel the CPU supports */
+static void str_simd_init(void) {
+#ifdef STR_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        str_cmp = str_cmp_avx2;
+        str_simd_name = "avx2";
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        str_cmp = str_cmp_sse42;
+        str_simd_name = "sse4.2";
+    }
+#endif
+}
+
+/* most unequal neighbours differ in the first byte: decide those inline */
+static inline int str_equal(const char *a, const char *b) {
+    return a[0] == b[0] && (a[0] == 0 || str_cmp(a + 1, b + 1) == 0);
+}
+
+/* equality with hashes cached by the caller: different hashes, different strings */
+static inline int str_equal_hashed(const char *a, uint64_t ha, const char *b, uint64_t hb) {
+    return ha == hb && str_equal(a, b);
+}
+
+/* equality with lengths known to the caller */
+static inline int str_equal_len(const char *a, size_t la, const char *b, size_t lb) {
+    return la == lb && memcmp(a, b, la) == 0;
+}
+
+#endif /* _STR_SIMD_H */
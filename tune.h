@@ -0,0 +1,132 @@
+/* Persistent tuning parameters for the automatic algorithm choice.
+ *
+ * Each program classifies its input from a small sample (sortedness,
+ * duplicates, ...) and picks the algorithm that won for that class of
+ * input on this host.  The thresholds of the classification and the
+ * winners are named parameters, kept in a text file of "name value" lines
+ * ('#' starts a comment):
+ *
+ *  presorted_max 0.05
+ *  alg_sorted 0
+ *
+ * tune_load() reads the file; tune_get() returns a parameter, or its
+ * default if the file did not set it; tune_set() changes it, and
+ * tune_save() writes all parameters back.  A tuning run ("tune" as the
+ * alg_type) measures the candidates on synthetic inputs of every class
+ * and saves the winners, so later "best" runs only read the file.
+ *
+ * The file is <program>.tune in the current directory unless -C names
+ * another one.  tune_quiet() silences stderr around the trial runs.
+ */
+
+#ifndef _TUNE_H
+#define _TUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define TUNE_MAX_PARAMS 32
+#define TUNE_NAME_LEN   32
+
+static struct {
+    char path[256];
+    int loaded;
+    int num_params;
+    char names[TUNE_MAX_PARAMS][TUNE_NAME_LEN];
+    double values[TUNE_MAX_PARAMS];
+    int saved_stderr;
+} tune = { "", 0, 0, { "" }, { 0.0 }, -1 };
+
+static void tune_set_path(const char *program, const char *path) {
+    if (path != NULL)
+        snprintf(tune.path, sizeof(tune.path), "%s", path);
+    else
+        snprintf(tune.path, sizeof(tune.path), "%s.tune", program);
+}
+
+static int tune_find(const char *name) {
+    int p;
+    for (p=0; p<tune.num_params; p++) {
+        if (strcmp(tune.names[p], name) == 0)
+            return p;
+    }
+    return -1;
+}
+
+static void tune_set(const char *name, double value) {
+    int p = tune_find(name);
+    if (p < 0) {
+        if (tune.num_params == TUNE_MAX_PARAMS) {
+            fprintf(stderr, "Error: more than %d tuning parameters!\n", TUNE_MAX_PARAMS);
+            exit(2);
+        }
+        p = tune.num_params++;
+        snprintf(tune.names[p], TUNE_NAME_LEN, "%s", name);
+    }
+    tune.values[p] = value;
+}
+
+/* the parameter, or def (which it then keeps, so tune_save() writes it) */
+static double tune_get(const char *name, double def) {
+    int p = tune_find(name);
+    if (p >= 0)
+        return tune.values[p];
+    tune_set(name, def);
+    return def;
+}
+
+/* returns 0 if the file was read */
+static int tune_load(void) {
+    FILE *fp = fopen(tune.path, "r");
+    if (fp == NULL)
+        return -1;
+    char line[256], name[TUNE_NAME_LEN];
+    double value;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%31s %lf", name, &value) == 2)
+            tune_set(name, value);
+    }
+    fclose(fp);
+    tune.loaded = 1;
+    return 0;
+}
+
+static int tune_save(const char *program) {
+    FILE *fp = fopen(tune.path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: could not write %s\n", tune.path);
+        return -1;
+    }
+    char host[64] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    fprintf(fp, "# %s tuning parameters for %s\n", program, host);
+    int p;
+    for (p=0; p<tune.num_params; p++)
+        fprintf(fp, "%s %g\n", tune.names[p], tune.values[p]);
+    fclose(fp);
+    return 0;
+}
+
+/* quiet != 0 sends stderr to /dev/null until the next tune_quiet(0) */
+static void tune_quiet(int quiet) {
+    fflush(stderr);
+    if (quiet && tune.saved_stderr < 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull < 0)
+            return;
+        tune.saved_stderr = dup(2);
+        dup2(devnull, 2);
+        close(devnull);
+    } else if (!quiet && tune.saved_stderr >= 0) {
+        dup2(tune.saved_stderr, 2);
+        close(tune.saved_stderr);
+        tune.saved_stderr = -1;
+    }
+}
+
+#endif /* _TUNE_H */
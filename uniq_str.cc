@@ -7,172 +7,507 @@
 #include <time.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include <algorithm>
 #include <map>
 #include <string>
+#include <vector>
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 #include "qsort.h"
-
-int stephen_find_uniq(char **B, int num_strings, int * counts); // header for my function
-int combine_partition(int p2_start, int p2_end, int * counts, char ** B, int uniq1, int uniq2); // header
-int kamesh_find_uniq(char **B, int num_strings, int * counts); // header
-
-void print_arr(char ** a, int n) {
-    int i;
+#include "alloc.h"
+#include "str_simd.h"
+#include "numa_place.h"
+#include "arena.h"
+#include "sort_ctx.h"
+#include "pool.h"
+#include "msort.h"
+#include "bench.h"
+#include "perf_counters.h"
+#include "phase_timer.h"
+#include "verify.h"
+#include "gen.h"
+#include "tune.h"
+
+int64_t stephen_find_uniq(char **B, int64_t num_strings, int64_t * counts); // header for my function
+int64_t combine_partition(int64_t p2_start, int64_t p2_end, int64_t * counts, char ** B, int64_t uniq1, int64_t uniq2); // header
+int64_t kamesh_find_uniq(char **B, int64_t num_strings, int64_t * counts); // header
+
+void print_arr(char ** a, int64_t n) {
+    int64_t i;
     for (i=0; i<n; i++)
         printf("'%s' ", a[i]);
     printf("\n");
 }
 
-void print_arr(int * a, int n) {
-    int i;
+void print_arr(int64_t * a, int64_t n) {
+    int64_t i;
     for (i=0; i<n; i++)
-        printf("%d ", a[i]);
+        printf("%lld ", (long long) a[i]);
     printf("\n");
 }
 
-static double timer() {
-    
-    struct timeval tp;
-    gettimeofday(&tp, NULL);
-    return ((double) (tp.tv_sec) + 1e-6 * tp.tv_usec);
 
-    /* The code below is for another high resolution timer */
-    /* I'm using gettimeofday because it's more portable */
 
-    /*
-    struct timespec tp;
-    clock_gettime(CLOCK_MONOTONIC, &tp);
-    return ((double) (tp.tv_sec) + 1e-9 * tp.tv_nsec);
-    */
+
+/* comparison routine for C's qsort */
+static int qs_cmpf(const void *u, const void *v) {
+
+    const char **u_s = (const char **) u;
+    const char **v_s = (const char **) v;
+    return (str_cmp(*u_s, *v_s));
+
 }
 
-void stephen_merge_sort(char ** a, int n) {
-    //printf("call n=%d ",n);
-    //print_arr(a,n);
-    
-    // IF the fragment is small we sort the small fragment
-    if (n <= 1) {
+/* inline QSORT() comparison routine */
+#define inline_qs_cmpf(a,b) (str_cmp((*a),(*b)) < 0)
+
+/* ------------------------------------------------------------------------
+ * LCP-aware loser tree.
+ *
+ * Merges k sorted sources.  Every source exposes its current string (str),
+ * whether it is exhausted (done), and lcp: the length of the common prefix
+ * of its current string and the last string output by the tree.  Since all
+ * lcps are relative to the same string, a match is decided by the lcps alone
+ * unless they are equal, and then characters before the lcp are never
+ * compared again.  The tree also caches every source's character at its
+ * lcp, so equal lcps followed by different characters are decided without
+ * touching either string, by one comparison of lcp and character packed
+ * into a key.  After the winner is output, its source must
+ * advance and set lcp relative to the string it just gave up.  Equal
+ * strings leave in source order, so merging runs of a stable sort keeps it
+ * stable.
+ * ------------------------------------------------------------------------ */
+
+#define LCP_TREE_INLINE 64  /* trees up to this many leaves are not malloc()ed */
+
+template <class Source>
+struct lcp_loser_tree {
+    Source *src;
+    int k;
+    int size;       /* number of leaves, a power of two >= k */
+    int *loser;     /* loser[node] is a source index, node in [1, size) */
+    int winner;
+    uint64_t *key;  /* see lcp_tree_key() */
+    int loser_buf[LCP_TREE_INLINE];
+    uint64_t key_buf[LCP_TREE_INLINE];
+};
+
+/* a source's lcp and its character at the lcp in one number, larger for
+   smaller strings: a longer lcp wins, then a smaller character.  0 for an
+   exhausted source.  Equal keys need a look at the strings. */
+template <class Source>
+static inline void lcp_tree_key(lcp_loser_tree<Source> *t, int i) {
+    if (i >= t->k || t->src[i].done) {
+        t->key[i] = 0;
         return;
     }
-    else if (n == 2) {
-//        if (*a[0] > *a[1]) {
-        if (strcmp(a[0], a[1]) > 0) {
-//            printf("%s > %s so swap\n", a[0], a[1]);
-            //printf("Pre-sort ");
-            //print_arr(a,n);
-            char * temp = a[0];
-            a[0] = a[1];
-            a[1] = temp;
-            //printf("Post-sort ");
-            //print_arr(a,n);
-        }
+    unsigned char c = (unsigned char) t->src[i].str[t->src[i].lcp];
+    t->key[i] = ((uint64_t) (t->src[i].lcp + 1) << 8) | (uint64_t) (255 - c);
+}
+
+/* play a against b when their keys are equal; the loser's lcp becomes
+   relative to the winner */
+template <class Source>
+static int lcp_tie(lcp_loser_tree<Source> *t, int a, int b) {
+    uint64_t k = t->key[a];
+    if (k == 0 || (k & 255) == 255)
+        return (a < b) ? a : b;     /* both exhausted, or equal strings */
+    const unsigned char *s = (const unsigned char *) t->src[a].str;
+    const unsigned char *u = (const unsigned char *) t->src[b].str;
+    int h = t->src[a].lcp + 1;
+    while (s[h] != '\0' && s[h] == u[h])
+        h++;
+    int w = (s[h] < u[h] || (s[h] == u[h] && a < b)) ? a : b;
+    int l = (w == a) ? b : a;
+    t->src[l].lcp = h;
+    lcp_tree_key(t, l);
+    return w;
+}
+
+template <class Source>
+static inline int lcp_match(lcp_loser_tree<Source> *t, int a, int b) {
+    if (t->key[a] == t->key[b])
+        return lcp_tie(t, a, b);
+    return (t->key[a] > t->key[b]) ? a : b;
+}
+
+template <class Source>
+static void lcp_tree_init(lcp_loser_tree<Source> *t, Source *src, int k) {
+    t->src = src;
+    t->k = k;
+    t->size = 1;
+    while (t->size < k)
+        t->size *= 2;
+    int win_buf[2 * LCP_TREE_INLINE];
+    int *win = win_buf;
+    t->loser = t->loser_buf;
+    t->key = t->key_buf;
+    if (t->size > LCP_TREE_INLINE) {
+        t->loser = (int *) malloc(t->size * sizeof(int));
+        t->key = (uint64_t *) malloc(t->size * sizeof(uint64_t));
+        win = (int *) malloc(2 * t->size * sizeof(int));
+        assert(t->loser != NULL && t->key != NULL && win != NULL);
+    }
+
+    int i;
+    for (i=0; i<t->size; i++) {
+        win[t->size + i] = i;
+        lcp_tree_key(t, i);
+    }
+    for (i=t->size-1; i>=1; i--) {
+        int w = lcp_match(t, win[2*i], win[2*i+1]);
+        t->loser[i] = (w == win[2*i]) ? win[2*i+1] : win[2*i];
+        win[i] = w;
+    }
+    t->winner = win[1];
+    if (win != win_buf)
+        free(win);
+}
+
+/* returns the source holding the smallest string, or -1 when all are done */
+template <class Source>
+static inline int lcp_tree_top(const lcp_loser_tree<Source> *t) {
+    if (t->winner >= t->k || t->src[t->winner].done)
+        return -1;
+    return t->winner;
+}
+
+/* call after the winning source has advanced */
+template <class Source>
+static inline void lcp_tree_replay(lcp_loser_tree<Source> *t) {
+    int c = t->winner;
+    lcp_tree_key(t, c);
+    uint64_t kc = t->key[c];
+    int node;
+    for (node=(t->size + c)/2; node>=1; node/=2) {
+        int l = t->loser[node];
+        uint64_t kl = t->key[l];
+        int w = (kl == kc) ? lcp_tie(t, c, l) : (kl > kc) ? l : c;
+        t->loser[node] = (w == c) ? l : c;
+        c = w;
+        kc = t->key[w];
+    }
+    t->winner = c;
+}
+
+template <class Source>
+static void lcp_tree_free(lcp_loser_tree<Source> *t) {
+    if (t->loser != t->loser_buf) {
+        free(t->loser);
+        free(t->key);
+    }
+    t->loser = NULL;
+    t->key = NULL;
+}
+
+/* ------------------------------------------------------------------------
+ * k-way LCP merge sort of strings.
+ *
+ * Leaves of LCP_SORT_LEAF strings are insertion sorted, then the runs are
+ * merged LCP_SORT_WAYS at a time through the LCP loser tree, so the
+ * pointers are passed over log_k(n / leaf) times instead of log2(n).
+ * Every run keeps the lcp of each string with its predecessor, which is
+ * what the tree needs when the run advances, and the tree yields the lcp of
+ * each output with the one before, so merged runs get their lcps for free
+ * and no merge compares a character of a prefix it already knows.
+ *
+ * The sort is stable.  With OpenMP the leaves and the merges of a pass run
+ * in parallel; a pass with fewer merges than threads splits every merge
+ * into parts at sampled splitter strings.
+ * ------------------------------------------------------------------------ */
+
+#define LCP_SORT_LEAF       16
+#define LCP_SORT_WAYS       16
+#define LCP_SPLIT_SAMPLE    16      /* strings per run to pick splitters */
+/* when stephen_merge_sort() uses it, see there */
+#define LCP_CHOICE_SAMPLE   1024    /* strings sampled for the average lcp */
+#define LCP_SORT_MIN_LCP    16.0    /* smallest sampled average lcp */
+#define LCP_SORT_MIN_N      (768 * 1024)
+
+/* a sorted run being merged: a source for lcp_loser_tree */
+struct lcp_run {
+    char **cur, **end;
+    const int32_t *cur_lcp;     /* lcp of *cur with its predecessor */
+    char *str;
+    int lcp;
+    int done;
+};
+
+/* the first string starts with an lcp of 0: nothing was output before it */
+static inline void lcp_run_start(lcp_run *r, char **begin, char **end, const int32_t *lcp) {
+    r->cur = begin;
+    r->end = end;
+    r->cur_lcp = lcp;
+    r->done = (begin == end);
+    r->str = r->done ? NULL : *begin;
+    r->lcp = 0;
+}
+
+static inline void lcp_run_next(lcp_run *r) {
+    r->cur++;
+    r->cur_lcp++;
+    if (r->cur == r->end) {
+        r->done = 1;
         return;
     }
-    
-    
-    
-    // OTHERWISE the fragment is large (n>2) and so we must split the fragment
-    // Boundary calculations:
-    //          START   SIZE
-    //  LEFT    0       n/2
-    //  RIGHT   n/2     n-n/2
-    
-    
-//    //#pragma omp task// firstprivate (a,n)
-//    const int PARALLEL_LIMIT = 512; // only spawn threads at a minimum threshold to prevent too much thread overhead
-//    if (PARALLEL_LIMIT>512) {
-//#pragma omp parallel sections
-//        {
-//#pragma omp section
-//            stephen_merge_sort(&a[0], n/2);     // left side
-//#pragma omp section
-//            stephen_merge_sort(&a[n/2], n-n/2); // right side
-//        }
-//    }
-//    else {
-        stephen_merge_sort(&a[0], n/2);     // left side
-        stephen_merge_sort(&a[n/2], n-n/2); // right side
-//    }
-    
-    //printf("pre-merge\n");
-    //printf("left: ");
-    //print_arr(a,n/2);
-    //printf("right: ");
-    //print_arr(&a[n/2], n-n/2);
-    
-    // now we must merge the two fragments
-    // first we add a temporary array to hold the two fragments
-    char ** temp_a = (char **)malloc(n * sizeof(char *));
-    int temp_a_i = 0;
-    int left_i = 0;
-    int right_i = n/2;
-    while (left_i < n/2 || right_i < n) {
-        // case 1. we have not reached the end of EITHER fragment
-        if (left_i < n/2 && right_i < n) {
-//            if (*a[left_i] < *a[right_i]) {
-            if (strcmp(a[left_i], a[right_i]) < 0) {
-                temp_a[temp_a_i] = a[left_i];
-//                printf("%s < %s so %s goes next\n", a[left_i], a[right_i], a[left_i]);
-                left_i ++;
+    r->str = *r->cur;
+    r->lcp = *r->cur_lcp;
+}
+
+/* length of the common prefix of a and b */
+static inline int32_t str_lcp(const char *a, const char *b) {
+    int32_t h = 0;
+    while (a[h] != '\0' && a[h] == b[h])
+        h++;
+    return h;
+}
+
+/* insertion sorts the leaf a[0..len) into out (which may be a) and sets
+   the lcps of its strings */
+static void lcp_sort_leaf(char **a, const int64_t len, char **out, int32_t *lcp) {
+    int64_t i, j;
+    if (out != a)
+        memcpy(out, a, len * sizeof(char *));
+    for (i=1; i<len; i++) {
+        char *hold = out[i];
+        for (j=i; j>0 && str_cmp(hold, out[j-1]) < 0; j--)
+            out[j] = out[j-1];
+        out[j] = hold;
+    }
+    lcp[0] = 0;
+    for (i=1; i<len; i++)
+        lcp[i] = str_lcp(out[i-1], out[i]);
+}
+
+/* splitter strings dividing the runs into parts of about equal size */
+static void lcp_split_strings(const lcp_run *runs, const int parts, char **split) {
+    char *sample[LCP_SORT_WAYS * LCP_SPLIT_SAMPLE];
+    int r, j, m = 0;
+    for (r=0; r<LCP_SORT_WAYS; r++) {
+        int64_t len = runs[r].end - runs[r].cur;
+        if (len == 0)
+            continue;
+        for (j=0; j<LCP_SPLIT_SAMPLE; j++)
+            sample[m++] = runs[r].cur[(len * j) / LCP_SPLIT_SAMPLE];
+    }
+    std::sort(sample, sample + m,
+            [](const char *u, const char *v) { return str_cmp(u, v) < 0; });
+    for (j=1; j<parts; j++)
+        split[j] = sample[((int64_t) m * j) / parts];
+}
+
+/* first position of the run whose string is not smaller than s */
+static int64_t lcp_run_lower_bound(char *const *a, int64_t len, const char *s) {
+    int64_t lo = 0, hi = len;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (str_cmp(a[mid], s) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* merges every LCP_SORT_WAYS runs of w strings of src into dst */
+static void lcp_merge_pass(char **src, const int32_t *src_lcp, char **dst, int32_t *dst_lcp,
+        const int64_t n, const int64_t w, int64_t *part_start) {
+    const int64_t span = w * LCP_SORT_WAYS;
+    const int64_t groups = (n + span - 1) / span;
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    int parts = (groups < threads) ? (int) ((threads + groups - 1) / groups) : 1;
+    if (parts > LCP_SORT_WAYS * LCP_SPLIT_SAMPLE)
+        parts = LCP_SORT_WAYS * LCP_SPLIT_SAMPLE;
+    int64_t task, num_tasks = groups * parts;
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+#ifdef _OPENMP
+        scoped_phase thread_phase(PHASE_SORT);
+#pragma omp for schedule(dynamic, 1)
+#endif
+        for (task=0; task<num_tasks; task++) {
+            const int64_t lo = (task / parts) * span;
+            const int p = (int) (task % parts);
+            lcp_run runs[LCP_SORT_WAYS];
+            int r;
+            for (r=0; r<LCP_SORT_WAYS; r++) {
+                int64_t b = std::min(lo + r*w, n);
+                int64_t e = std::min(lo + (r+1)*w, n);
+                lcp_run_start(&runs[r], src + b, src + e, src_lcp + b);
+            }
+
+            /* narrow every run to the part's strings, which start after all
+               the smaller strings of the group */
+            int64_t out = lo;
+            if (parts > 1) {
+                char *split[LCP_SORT_WAYS * LCP_SPLIT_SAMPLE];
+                lcp_split_strings(runs, parts, split);
+                for (r=0; r<LCP_SORT_WAYS; r++) {
+                    int64_t len = runs[r].end - runs[r].cur;
+                    int64_t b = (p == 0) ? 0 : lcp_run_lower_bound(runs[r].cur, len, split[p]);
+                    int64_t e = (p == parts-1) ? len : lcp_run_lower_bound(runs[r].cur, len, split[p+1]);
+                    out += b;
+                    lcp_run_start(&runs[r], runs[r].cur + b, runs[r].cur + e, runs[r].cur_lcp + b);
+                }
             }
-            else {
-                temp_a[temp_a_i] = a[right_i];
-//                printf("%s >= %s so %s goes next\n", a[left_i], a[right_i], a[right_i]);
-                right_i ++;
+            part_start[task] = out;
+
+            /* runs already in order are copied; the lcps where they meet are
+               the only ones to compute */
+            int in_order = 1;
+            const char *last = NULL;
+            for (r=0; r<LCP_SORT_WAYS && in_order; r++) {
+                if (runs[r].done)
+                    continue;
+                in_order = (last == NULL || str_cmp(last, runs[r].str) <= 0);
+                last = runs[r].end[-1];
             }
+            if (in_order) {
+                last = NULL;
+                for (r=0; r<LCP_SORT_WAYS; r++) {
+                    int64_t len = runs[r].end - runs[r].cur;
+                    if (len == 0)
+                        continue;
+                    memcpy(dst + out, runs[r].cur, len * sizeof(char *));
+                    memcpy(dst_lcp + out, runs[r].cur_lcp, len * sizeof(int32_t));
+                    dst_lcp[out] = (last == NULL) ? 0 : str_lcp(last, runs[r].str);
+                    last = runs[r].end[-1];
+                    out += len;
+                }
+                continue;
+            }
+
+            lcp_loser_tree<lcp_run> tree;
+            lcp_tree_init(&tree, runs, LCP_SORT_WAYS);
+            int winner;
+            while ((winner = lcp_tree_top(&tree)) >= 0) {
+                dst[out] = runs[winner].str;
+                dst_lcp[out] = runs[winner].lcp;
+                out++;
+                lcp_run_next(&runs[winner]);
+                lcp_tree_replay(&tree);
+            }
+            lcp_tree_free(&tree);
         }
-        // case 2. we have not reached the end of ONLY the left side
-        else if (left_i < n/2) {
-            temp_a[temp_a_i] = a[left_i];
-            left_i ++;
-        }
-        // case 3. we have not reached the end of ONLY the right side
-        else {
-            temp_a[temp_a_i] = a[right_i];
-            right_i ++;
+    }
+
+    /* a part's first lcp is relative to the last string of the part before */
+    if (parts > 1) {
+        for (task=0; task<num_tasks; task++) {
+            int64_t i = part_start[task];
+            int64_t group_hi = std::min((task / parts + 1) * span, n);
+            if (task % parts != 0 && i > 0 && i < group_hi)
+                dst_lcp[i] = str_lcp(dst[i-1], dst[i]);
         }
-        temp_a_i ++;
     }
-    
-    //printf("temp array: ");
-    //print_arr(temp_a, n);
-    
-    memcpy(a, temp_a, n * sizeof(char **));   // copy our work to the main array
-    free(temp_a);           // free the temporary array
-    
-    //printf("post-merge: ");
-    //print_arr(a,n);
-    
-    // the fragements for this section are now successfully sorted. we now return.
-    return;
-    
 }
 
+/* sorts a[0..n), stably; if lcp is not NULL, lcp[i] gets the length of
+   the common prefix of a[i-1] and a[i] (lcp[0] = 0) */
+static void lcp_merge_sort(char **a, const int64_t n, int32_t *lcp) {
+    if (n == 0)
+        return;
+    arena *scratch = arena_local();
+    arena_mark mark = arena_save(scratch);
+    char **tmp = (char **) arena_alloc_array(scratch, n, sizeof(char *));
+    int32_t *lcp_a = (int32_t *) arena_alloc_array(scratch, n, sizeof(int32_t));
+    int32_t *lcp_b = (int32_t *) arena_alloc_array(scratch, n, sizeof(int32_t));
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    int64_t *part_start = (int64_t *) arena_alloc_array(scratch,
+            (n + LCP_SORT_LEAF - 1) / LCP_SORT_LEAF + threads, sizeof(int64_t));
+
+    int64_t w, i;
+    int passes = 0;
+    for (w=LCP_SORT_LEAF; w<n; w*=LCP_SORT_WAYS)
+        passes++;
+
+    /* the leaves go where an even number of passes ends in a */
+    char **src = (passes & 1) ? tmp : a;
+    char **dst = (passes & 1) ? a : tmp;
+    int32_t *src_lcp = lcp_a, *dst_lcp = lcp_b;
+#ifdef _OPENMP
+#pragma omp parallel if(n >= MSORT_PARALLEL_CUTOFF)
+#endif
+    {
+#ifdef _OPENMP
+        scoped_phase thread_phase(PHASE_SORT);
+#pragma omp for schedule(static)
+#endif
+        for (i=0; i<n; i+=LCP_SORT_LEAF) {
+            int64_t len = std::min((int64_t) LCP_SORT_LEAF, n - i);
+            lcp_sort_leaf(a + i, len, src + i, src_lcp + i);
+        }
+    }
 
+    for (w=LCP_SORT_LEAF; w<n; w*=LCP_SORT_WAYS) {
+        lcp_merge_pass(src, src_lcp, dst, dst_lcp, n, w, part_start);
+        std::swap(src, dst);
+        std::swap(src_lcp, dst_lcp);
+    }
 
-/* comparison routine for C's qsort */
-static int qs_cmpf(const void *u, const void *v) {
-
-    const char **u_s = (const char **) u;
-    const char **v_s = (const char **) v;
-    return (strcmp(*u_s, *v_s));
+    if (lcp != NULL)
+        memcpy(lcp, src_lcp, n * sizeof(int32_t));
+    arena_release(scratch, mark);
+}
 
+/* average lcp of the distinct neighbours in a sorted sample of a */
+static double lcp_sample_avg(char **a, const int64_t n) {
+    char *sample[LCP_CHOICE_SAMPLE];
+    const uint64_t seed = gen_seed ^ 0x6c637073ULL;
+    int64_t k, m = (n < LCP_CHOICE_SAMPLE) ? n : LCP_CHOICE_SAMPLE;
+    for (k=0; k<m; k++)
+        sample[k] = a[(m == n) ? k : (int64_t) (gen_u64(seed, k) % (uint64_t) n)];
+    std::sort(sample, sample + m,
+            [](const char *u, const char *v) { return str_cmp(u, v) < 0; });
+    int64_t distinct = 0, total_lcp = 0;
+    for (k=1; k<m; k++) {
+        int32_t l = str_lcp(sample[k-1], sample[k]);
+        if (sample[k-1][l] != sample[k][l]) {
+            distinct++;
+            total_lcp += l;
+        }
+    }
+    return (distinct > 0) ? (double) total_lcp / distinct : 0.0;
 }
 
-/* inline QSORT() comparison routine */
-#define inline_qs_cmpf(a,b) (strcmp((*a),(*b)) < 0)
+/* stable: equal strings keep their order in a.  The LCP merge sort only
+   pays for its lcp arrays on many strings with long shared prefixes; other
+   inputs take the binary MSORT(), whose in-order shortcut also suits small
+   presorted arrays better */
+void stephen_merge_sort(char ** a, int64_t n) {
+    if (n >= LCP_SORT_MIN_N && lcp_sample_avg(a, n) >= LCP_SORT_MIN_LCP) {
+        lcp_merge_sort(a, n, NULL);
+        return;
+    }
+    arena *scratch = arena_local();
+    arena_mark mark = arena_save(scratch);
+    char **tmp = (char **) arena_alloc_array(scratch, n, sizeof(char *));
+    MSORT(char*, a, n, inline_qs_cmpf, tmp);
+    arena_release(scratch, mark);
+}
 
 /* comparison routine for STL sort */
 class compare_str_cmpf {
     public:
         bool operator() (char *u, char *v) {
 
-            int cmpval = strcmp(u, v);
+            int cmpval = str_cmp(u, v);
 
             if (cmpval < 0)
                 return true;
@@ -181,53 +516,256 @@ class compare_str_cmpf {
         }
 };
 
-int find_uniq_qsort(char *str_array, const int str_array_size, 
-        const int num_strings, const int num_iterations) {
+/* 64-bit string hash: FNV-1a finished with the murmur3 mixer */
+static inline uint64_t str_hash64(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* a string with its fingerprint: sorted together, so the counting pass
+   reads the fingerprints in order and only touches the bytes of neighbours
+   whose fingerprints match */
+struct str_ref {
+    char *str;
+    uint64_t fp;
+};
+
+#define inline_ref_cmpf(a,b) (str_cmp((a)->str, (b)->str) < 0)
+
+class compare_ref_cmpf {
+    public:
+        bool operator() (const str_ref &u, const str_ref &v) {
+            return str_cmp(u.str, v.str) < 0;
+        }
+};
+
+/* points lines[j] at the j-th of the num_strings strings in str_array */
+static void tokenize_lines(char *str_array, const int64_t str_array_size,
+        const int64_t num_strings, char **lines) {
+    int64_t i, j;
+    lines[0] = &str_array[0];
+    j = 1;
+    for (i=0; i<str_array_size-1; i++) {
+        if (str_array[i] == '\0') {
+            lines[j] = &str_array[i+1];
+            j++;
+        }
+    }
+    assert(j == num_strings);
+}
+
+/* splits str_array into its num_strings strings and fingerprints each one,
+   in one pass over the bytes.  Every thread takes an equal byte range and
+   the strings that start in it; a first pass counts them to find where each
+   thread's strings go. */
+static void tokenize_fp(char *str_array, const int64_t str_array_size,
+        const int64_t num_strings, str_ref *R) {
+    int num_threads = 1;
+#ifdef _OPENMP
+    num_threads = omp_get_max_threads();
+#endif
+    int64_t first[POOL_MAX_CPUS + 1] = { 0 };
+    assert(num_threads <= POOL_MAX_CPUS);
+
+#pragma omp parallel num_threads(num_threads)
+    {
+        int t = 0;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#endif
+        int64_t lo = (str_array_size * t) / num_threads;
+        int64_t hi = (str_array_size * (t+1)) / num_threads;
+        int64_t i, k = 0;
+
+        /* a string starts at 0 and after every '\0' but the last */
+        for (i=lo; i<hi; i++) {
+            if (i == 0 || str_array[i-1] == '\0')
+                k++;
+        }
+        first[t+1] = k;
+#pragma omp barrier
+#pragma omp single
+        for (i=0; i<num_threads; i++)
+            first[i+1] += first[i];
+
+        k = first[t];
+        i = lo;
+        while (i > 0 && i < hi && str_array[i-1] != '\0')
+            i++;
+        while (i < hi) {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            int64_t start = i;
+            while (str_array[i] != '\0') {
+                h ^= (unsigned char) str_array[i++];
+                h *= 0x100000001b3ULL;
+            }
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            R[k].str = &str_array[start];
+            R[k].fp = h;
+            k++;
+            i++;
+        }
+    }
+    assert(first[num_threads] == num_strings);
+}
+
+/* counts runs of equal strings in sorted R, comparing bytes only when the
+   fingerprints match; returns the number of unique strings */
+static int64_t count_uniq_fp(const str_ref *R, const int64_t num_strings, int64_t *counts) {
+    int64_t num_uniq_strings = 1;
+    int64_t string_occurrence_count = 1;
+    int64_t i;
+    for (i=1; i<num_strings; i++) {
+        if (!str_equal_hashed(R[i].str, R[i].fp, R[i-1].str, R[i-1].fp)) {
+            num_uniq_strings++;
+            counts[i-1] = string_occurrence_count;
+            string_occurrence_count = 1;
+        } else {
+            string_occurrence_count++;
+        }
+    }
+    counts[num_strings-1] = string_occurrence_count;
+    return num_uniq_strings;
+}
+
+/* order-independent checksum of the strings in str_array, see verify.h */
+static uint64_t str_array_checksum(const char *str_array, const int64_t str_array_size) {
+    uint64_t sum = 0;
+    int64_t i = 0;
+    while (i < str_array_size) {
+        sum += verify_mix(str_hash64(&str_array[i]));
+        i += strlen(&str_array[i]) + 1;
+    }
+    return sum;
+}
+
+static inline const char *ref_str(const char *s) {
+    return s;
+}
+
+static inline const char *ref_str(const str_ref &r) {
+    return r.str;
+}
+
+/* a fingerprint carried through the sort must still match its string */
+static inline int ref_fp_ok(const char *, uint64_t) {
+    return 1;
+}
+
+static inline int ref_fp_ok(const str_ref &r, uint64_t h) {
+    return r.fp == h;
+}
+
+/* checks a sorted B (char * or str_ref) and counts laid out as
+   kamesh_find_uniq() leaves them: the length of every run of equal strings
+   at its last element.  Full mode also checks that B holds the input
+   strings and that the runs add up; sample mode looks at run ends only
+   within VERIFY_SAMPLES strings of their start. */
+template <class T>
+static void verify_uniq(const T *B, const int64_t num_strings, const int64_t *counts,
+        const int64_t num_uniq_strings, const char *what) {
+    double t0 = verify_begin();
+    const int64_t m = verify_num_checks(num_strings);
+    const int64_t limit = (verify.mode == VERIFY_FULL) ? num_strings : verify.samples;
+    int64_t k, errors = 0, runs = 0, total_strings = 0;
+    uint64_t sum = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:errors,runs,total_strings,sum)
+#endif
+    for (k=0; k<m; k++) {
+        int64_t i = verify_index(k, num_strings);
+        const char *s = ref_str(B[i]);
+        uint64_t h = str_hash64(s);
+        sum += verify_mix(h);
+        errors += !ref_fp_ok(B[i], h);
+        if (i > 0 && str_cmp(ref_str(B[i-1]), s) > 0)
+            errors++;
+        if (i == num_strings-1 || !str_equal(s, ref_str(B[i+1]))) {
+            int64_t j = i;
+            while (j > 0 && i - j < limit && str_equal(ref_str(B[j-1]), s))
+                j--;
+            if (i - j < limit)
+                errors += (counts[i] != i - j + 1);
+            runs++;
+            total_strings += counts[i];
+        }
+    }
+    if (verify.mode == VERIFY_FULL) {
+        errors += (sum != verify.input_sum);
+        errors += (runs != num_uniq_strings);
+        errors += (total_strings != num_strings);
+    }
+    verify_end(t0, errors, what);
+}
+
+int find_uniq_qsort(char *str_array, const int64_t str_array_size, 
+        const int64_t num_strings, const int num_iterations) {
 
-    fprintf(stderr, "N %d\n", num_strings);
+    fprintf(stderr, "N %lld\n", (long long) num_strings);
     fprintf(stderr, "Using C qsort\n");
     fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
 
     int iter;
     double avg_elt;
 
+    /* the input is tokenized once, into lines; B, the counts and
+       everything an iteration allocates live in a sort context, which is
+       released before every iteration (sort_ctx.h) */
+    sort_ctx ctx;
+    sort_ctx_init(&ctx);
+
+    char **lines;
+    lines = (char **) sort_ctx_buffer(&ctx, num_strings, sizeof(char *));
     char **B;
-    B = (char **) malloc(num_strings * sizeof(char *));
-    assert(B != NULL);
+    B = (char **) sort_ctx_buffer(&ctx, num_strings, sizeof(char *));
 
-    int *counts;
-    counts = (int *) malloc(num_strings * sizeof(int));
-    int *kamesh_counts;
-    kamesh_counts = (int *) malloc(num_strings * sizeof(int));
+    int64_t *counts;
+    counts = (int64_t *) sort_ctx_buffer(&ctx, num_strings, sizeof(int64_t));
+
+    tokenize_lines(str_array, str_array_size, num_strings, lines);
+    sort_ctx_ready(&ctx);
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
 
     avg_elt = 0.0;
 
-    for (iter = 0; iter < num_iterations; iter++) {
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
         
-        int i, j;
-
-        B[0] = &str_array[0];
-        j = 1;
-        for (i=0; i<str_array_size-1; i++) {
-            if (str_array[i] == '\0') {
-                B[j] = &str_array[i+1];
-                j++;    
-            }
-        }
-        assert(j == num_strings);
+        int64_t i;
 
-        for (i=0; i<num_strings; i++) {
-            counts[i] = 0;
-            kamesh_counts[i] = 0;
-        }
+        sort_ctx_reset(&ctx, iter);
+        scoped_phase phase(PHASE_TOKENIZE);
+
+        sort_ctx_copy(B, lines, num_strings * sizeof(char *));
+        sort_ctx_zero(counts, num_strings * sizeof(int64_t));
 
         double elt;
         elt = timer();
+        perf_begin(&pp);
+        phase.next(PHASE_SORT);
 
 //        qsort(B, num_strings, sizeof(char *), qs_cmpf);
         //printf("### PRE SORT ###\n");
         //print_arr(B,num_strings);
         stephen_merge_sort(B, num_strings);
+        perf_phase(&pp, "sort");
+        phase.next(PHASE_COUNT);
         //printf("### POST SORT ###\n");
         //print_arr(B,num_strings);
 
@@ -255,80 +793,69 @@ int find_uniq_qsort(char *str_array, const int str_array_size,
         /* parallel version */
         /* determine number of unique strings and count each */
         const int NUM_THREADS = 4;
-        int * num_uniq_strings = (int *)malloc(sizeof(int) * NUM_THREADS);
-        for (i=0; i<NUM_THREADS; i++) {
-            int partition_num_strings = num_strings / NUM_THREADS;
-            int start_position = partition_num_strings * i;
-            if (i==NUM_THREADS-1)
+        int64_t * num_uniq_strings = (int64_t *) sort_ctx_buffer(&ctx, NUM_THREADS, sizeof(int64_t));
+        pool_parallel_for(0, NUM_THREADS, 1, [&](int64_t p) {
+#ifdef _OPENMP
+            scoped_phase thread_phase(PHASE_COUNT);
+#endif
+            int64_t partition_num_strings = num_strings / NUM_THREADS;
+            int64_t start_position = partition_num_strings * p;
+            if (p==NUM_THREADS-1)
                 partition_num_strings += num_strings - partition_num_strings * NUM_THREADS;
             
-            num_uniq_strings[i] = stephen_find_uniq(&B[start_position], partition_num_strings, &counts[start_position]);
-        }
+            num_uniq_strings[p] = stephen_find_uniq(&B[start_position], partition_num_strings, &counts[start_position]);
+        });
 //        printf("before inconsistency fix: \n");
 //        print_arr(counts, num_strings);
         
+        perf_phase(&pp, "count");
+        phase.next(PHASE_FIXUP);
         /* now fix the inconsistensies */
         for (i=1; i<NUM_THREADS; i++) {
-            int partition_num_strings = num_strings / NUM_THREADS;
-            int start_position = partition_num_strings * i;
+            int64_t partition_num_strings = num_strings / NUM_THREADS;
+            int64_t start_position = partition_num_strings * i;
             if (i==NUM_THREADS-1)
                 partition_num_strings += num_strings - partition_num_strings * NUM_THREADS;
             
-            int end_position = start_position + partition_num_strings -1;
+            int64_t end_position = start_position + partition_num_strings -1;
             num_uniq_strings[0] = combine_partition(start_position, end_position, counts, B, num_uniq_strings[0], num_uniq_strings[i]);
             
         }
         
-        kamesh_find_uniq(B, num_strings, kamesh_counts);
-        
-//        printf("after inconsistency fix: \n");
-//        print_arr(counts, num_strings);
-//        print_arr(kamesh_counts, num_strings);
-        
-        
-                                                    
-
+        perf_phase(&pp, "fixup");
+        phase.next(PHASE_VERIFY);
         elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
         avg_elt += elt;
         fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, num_strings);
 
 
         /* optionally print out unique strings */
         /*
         for (i=0; i<num_strings; i++) {
             if (counts[i] != 0) {
-                fprintf(stderr, "%s\t%d\n", B[i], counts[i]);
+                fprintf(stderr, "%s\t%lld\n", B[i], (long long) counts[i]);
             }
         }
-        fprintf(stderr, "Number of unique strings: %d\n", num_uniq_strings);
+        fprintf(stderr, "Number of unique strings: %lld\n", (long long) num_uniq_strings);
         */
 
-        /* a complete correctness check */
-                                                    
-//        int total_strings = counts[0];
-        for (i=1; i<num_strings; i++) {
-            assert(strcmp(B[i], B[i-1]) >= 0);
-            if (strcmp(B[i], B[i-1]) != 0) {
-                if (counts[i-1] != kamesh_counts[i-1]) {
-                    printf("%d %d\n", counts[i-1], kamesh_counts[i-1]);
-//                    print_arr(counts, num_strings);
-//                    print_arr(kamesh_counts, num_strings);
-                }
-                assert(counts[i-1] == kamesh_counts[i-1]);
-                
-            }
-//            total_strings += counts[i];
-            /* assure the counts to complete the check */
-            
-        }
-//        assert(total_strings == num_strings);
+        /* a complete correctness check: every run end against its length */
+        verify_uniq(B, num_strings, counts, num_uniq_strings[0], "merge_sort");
                                                     
     }
                                                     
     avg_elt = avg_elt/num_iterations;
     
-    free(B);
-    free(counts);
+    sort_ctx_report(&ctx);
+    sort_ctx_free(&ctx);
+
+    perf_summary(&pp, num_strings);
+    bench_report("merge_sort", num_strings, str_array_size, times, num_iterations);
+    free(times);
 
     fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
     fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", str_array_size/(avg_elt*1e6));
@@ -337,13 +864,13 @@ int find_uniq_qsort(char *str_array, const int str_array_size,
 }
                                                     
 // returns the number of unique strings in this partition
-int stephen_find_uniq(char **B, int num_strings, int * counts) {
+int64_t stephen_find_uniq(char **B, int64_t num_strings, int64_t * counts) {
 //    printf("stephen called: ")
-    int num_uniq_strings = 1;
-    int string_occurrence_count = 1;
-    int i;
+    int64_t num_uniq_strings = 1;
+    int64_t string_occurrence_count = 1;
+    int64_t i;
     for (i=1; i<num_strings; i++) {
-        if (strcmp(B[i], B[i-1]) != 0) {
+        if (!str_equal(B[i], B[i-1])) {
             num_uniq_strings++;
             counts[i-1] = string_occurrence_count;
             counts[i-string_occurrence_count] = string_occurrence_count;
@@ -360,12 +887,12 @@ int stephen_find_uniq(char **B, int num_strings, int * counts) {
 }
 
 // original counts
-int kamesh_find_uniq(char **B, int num_strings, int * counts) {
-    int num_uniq_strings = 1;
-    int string_occurrence_count = 1;
-    int i;
+int64_t kamesh_find_uniq(char **B, int64_t num_strings, int64_t * counts) {
+    int64_t num_uniq_strings = 1;
+    int64_t string_occurrence_count = 1;
+    int64_t i;
     for (i=1; i<num_strings; i++) {
-        if (strcmp(B[i], B[i-1]) != 0) {
+        if (!str_equal(B[i], B[i-1])) {
             num_uniq_strings++;
             counts[i-1] = string_occurrence_count;
             string_occurrence_count = 1;
@@ -381,16 +908,16 @@ int kamesh_find_uniq(char **B, int num_strings, int * counts) {
 
 // it is assumed that this function is executed left to right
 // because the number of partitions is small this function should be executed serially
-int combine_partition(int p2_start, int p2_end, int * counts, char ** B, int uniq1, int uniq2) {
+int64_t combine_partition(int64_t p2_start, int64_t p2_end, int64_t * counts, char ** B, int64_t uniq1, int64_t uniq2) {
     // first we see if there is a problem
-    if (strcmp(B[p2_start], B[p2_start-1]) != 0) {
+    if (!str_equal(B[p2_start], B[p2_start-1])) {
         // if there is no problem, that is, the partitions did not cut a continuous partition, we just do the math and return
         return uniq1 + uniq2;
     }
     // fi there is a problem, then we have some work to do
     else {
         // first we make the continuous segment consistent
-        int new_count = counts[p2_start-1] + counts[p2_start];
+        int64_t new_count = counts[p2_start-1] + counts[p2_start];
         counts[p2_start + counts[p2_start] -1] = new_count;
         return uniq1 + uniq2 - 1;
     }
@@ -398,99 +925,100 @@ int combine_partition(int p2_start, int p2_end, int * counts, char ** B, int uni
                                                     
 
 
-int find_uniq_inline_qsort(char *str_array, const int str_array_size,
-        const int num_strings, const int num_iterations) {
-    
-    printf("Hello!\n");
+int find_uniq_inline_qsort(char *str_array, const int64_t str_array_size,
+        const int64_t num_strings, const int num_iterations) {
 
-    fprintf(stderr, "N %d\n", num_strings);
+    fprintf(stderr, "N %lld\n", (long long) num_strings);
     fprintf(stderr, "Using inline qsort\n");
     fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
 
     int iter;
     double avg_elt;
 
-    char **B;
-    B = (char **) malloc(num_strings * sizeof(char *));
-    assert(B != NULL);
+    /* the input is tokenized and fingerprinted once, into R0; R, the
+       counts and everything an iteration allocates live in a sort context,
+       which is released before every iteration (sort_ctx.h) */
+    sort_ctx ctx;
+    sort_ctx_init(&ctx);
+
+    str_ref *R0;
+    R0 = (str_ref *) sort_ctx_buffer(&ctx, num_strings, sizeof(str_ref));
+    str_ref *R;
+    R = (str_ref *) sort_ctx_buffer(&ctx, num_strings, sizeof(str_ref));
 
-    int *counts;
-    counts = (int *) malloc(num_strings * sizeof(int));
+    int64_t *counts;
+    counts = (int64_t *) sort_ctx_buffer(&ctx, num_strings, sizeof(int64_t));
+
+    tokenize_fp(str_array, str_array_size, num_strings, R0);
+    sort_ctx_ready(&ctx);
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
 
     avg_elt = 0.0;
 
-    for (iter = 0; iter < num_iterations; iter++) {
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
         
-        int i, j;
-
-        B[0] = &str_array[0];
-        j = 1;
-        for (i=0; i<str_array_size-1; i++) {
-            if (str_array[i] == '\0') {
-                B[j] = &str_array[i+1];
-                j++;    
-            }
-        }
-        assert(j == num_strings);
+        sort_ctx_reset(&ctx, iter);
+        scoped_phase phase(PHASE_TOKENIZE);
 
-        for (i=0; i<num_strings; i++) {
-            counts[i] = 0;
-        }
+        sort_ctx_copy(R, R0, num_strings * sizeof(str_ref));
+        sort_ctx_zero(counts, num_strings * sizeof(int64_t));
 
         double elt;
         elt = timer();
+        perf_begin(&pp);
+        phase.next(PHASE_SORT);
 
-        QSORT(char*, B, num_strings, inline_qs_cmpf);
+        QSORT(str_ref, R, num_strings, inline_ref_cmpf);
+        perf_phase(&pp, "sort");
+        phase.next(PHASE_COUNT);
 
         /*
         for (i=0; i<num_strings; i++) {
-            fprintf(stderr, "%s\n", B[i]);
+            fprintf(stderr, "%s\n", R[i].str);
         }
         */
 
         /* determine number of unique strings 
            and count of each string */
-        int num_uniq_strings = 1;
-        int string_occurrence_count = 1;
-        for (i=1; i<num_strings; i++) {
-            if (strcmp(B[i], B[i-1]) != 0) {
-                num_uniq_strings++;
-                counts[i-1] = string_occurrence_count;
-                string_occurrence_count = 1;
-            } else {
-                string_occurrence_count++;
-            }
-        }
-        counts[num_strings-1] = string_occurrence_count;
+        int64_t num_uniq_strings = count_uniq_fp(R, num_strings, counts);
 
         /* optionally print out unique strings */
         /*
         for (i=0; i<num_strings; i++) {
             if (counts[i] != 0) {
-                fprintf(stderr, "%s\t%d\n", B[i], counts[i]);
+                fprintf(stderr, "%s\t%lld\n", R[i].str, (long long) counts[i]);
             }
         }
-        fprintf(stderr, "Number of unique strings: %d\n", num_uniq_strings);
+        fprintf(stderr, "Number of unique strings: %lld\n", (long long) num_uniq_strings);
         */
 
+        perf_phase(&pp, "count");
+        phase.next(PHASE_VERIFY);
         elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
         avg_elt += elt;
         fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, num_strings);
 
-        /* an incomplete correctness check */
-        int total_strings = counts[0];
-        for (i=1; i<num_strings; i++) {
-            assert(strcmp(B[i], B[i-1]) >= 0);
-            total_strings += counts[i];
-        }
-        assert(total_strings == num_strings);
+        /* a complete correctness check */
+        verify_uniq(R, num_strings, counts, num_uniq_strings, "inline_qsort");
 
     }
 
     avg_elt = avg_elt/num_iterations;
     
-    free(B);
-    free(counts);
+    sort_ctx_report(&ctx);
+    sort_ctx_free(&ctx);
+
+    perf_summary(&pp, num_strings);
+    bench_report("inline_qsort", num_strings, str_array_size, times, num_iterations);
+    free(times);
 
     fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
     fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", str_array_size/(avg_elt*1e6));
@@ -500,98 +1028,101 @@ int find_uniq_inline_qsort(char *str_array, const int str_array_size,
 
 }
 
-int find_uniq_stl_sort(char *str_array, const int str_array_size,
-        const int num_strings, const int num_iterations) {
+int find_uniq_stl_sort(char *str_array, const int64_t str_array_size,
+        const int64_t num_strings, const int num_iterations) {
 
-    fprintf(stderr, "N %d\n", num_strings);
+    fprintf(stderr, "N %lld\n", (long long) num_strings);
     fprintf(stderr, "Using STL sort\n");
     fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
 
     int iter;
     double avg_elt;
 
-    char **B;
-    B = (char **) malloc(num_strings * sizeof(char *));
-    assert(B != NULL);
+    /* the input is tokenized and fingerprinted once, into R0; R, the
+       counts and everything an iteration allocates live in a sort context,
+       which is released before every iteration (sort_ctx.h) */
+    sort_ctx ctx;
+    sort_ctx_init(&ctx);
+
+    str_ref *R0;
+    R0 = (str_ref *) sort_ctx_buffer(&ctx, num_strings, sizeof(str_ref));
+    str_ref *R;
+    R = (str_ref *) sort_ctx_buffer(&ctx, num_strings, sizeof(str_ref));
 
-    int *counts;
-    counts = (int *) malloc(num_strings * sizeof(int));
+    int64_t *counts;
+    counts = (int64_t *) sort_ctx_buffer(&ctx, num_strings, sizeof(int64_t));
+
+    tokenize_fp(str_array, str_array_size, num_strings, R0);
+    sort_ctx_ready(&ctx);
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
 
     avg_elt = 0.0;
 
-    for (iter = 0; iter < num_iterations; iter++) {
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
         
-        int i, j;
-
-        B[0] = &str_array[0];
-        j = 1;
-        for (i=0; i<str_array_size-1; i++) {
-            if (str_array[i] == '\0') {
-                B[j] = &str_array[i+1];
-                j++;    
-            }
-        }
-        assert(j == num_strings);
+        sort_ctx_reset(&ctx, iter);
+        scoped_phase phase(PHASE_TOKENIZE);
 
-        for (i=0; i<num_strings; i++) {
-            counts[i] = 0;
-        }
+        sort_ctx_copy(R, R0, num_strings * sizeof(str_ref));
+        sort_ctx_zero(counts, num_strings * sizeof(int64_t));
 
         double elt;
         elt = timer();
+        perf_begin(&pp);
+        phase.next(PHASE_SORT);
 
-        compare_str_cmpf cmpf;
-        std::sort(B, B+num_strings, cmpf);
+        compare_ref_cmpf cmpf;
+        std::sort(R, R+num_strings, cmpf);
+        perf_phase(&pp, "sort");
+        phase.next(PHASE_COUNT);
 
         /*
         for (i=0; i<num_strings; i++) {
-            fprintf(stderr, "%s\n", B[i]);
+            fprintf(stderr, "%s\n", R[i].str);
         }
         */
 
         /* determine number of unique strings 
            and count of each string */
-        int num_uniq_strings = 1;
-        int string_occurrence_count = 1;
-        for (i=1; i<num_strings; i++) {
-            if (strcmp(B[i], B[i-1]) != 0) {
-                num_uniq_strings++;
-                counts[i-1] = string_occurrence_count;
-                string_occurrence_count = 1;
-            } else {
-                string_occurrence_count++;
-            }
-        }
-        counts[num_strings-1] = string_occurrence_count;
+        int64_t num_uniq_strings = count_uniq_fp(R, num_strings, counts);
 
         /* optionally print out unique strings */
         /*
         for (i=0; i<num_strings; i++) {
             if (counts[i] != 0) {
-                fprintf(stderr, "%s\t%d\n", B[i], counts[i]);
+                fprintf(stderr, "%s\t%lld\n", R[i].str, (long long) counts[i]);
             }
         }
-        fprintf(stderr, "Number of unique strings: %d\n", num_uniq_strings);
+        fprintf(stderr, "Number of unique strings: %lld\n", (long long) num_uniq_strings);
         */
 
+        perf_phase(&pp, "count");
+        phase.next(PHASE_VERIFY);
         elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
         avg_elt += elt;
         fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, num_strings);
 
-        /* an incomplete correctness check */
-        int total_strings = counts[0];
-        for (i=1; i<num_strings; i++) {
-            assert(strcmp(B[i], B[i-1]) >= 0);
-            total_strings += counts[i];
-        }
-        assert(total_strings == num_strings);
+        /* a complete correctness check */
+        verify_uniq(R, num_strings, counts, num_uniq_strings, "stl_sort");
 
     }
 
     avg_elt = avg_elt/num_iterations;
     
-    free(B);
-    free(counts);
+    sort_ctx_report(&ctx);
+    sort_ctx_free(&ctx);
+
+    perf_summary(&pp, num_strings);
+    bench_report("stl_sort", num_strings, str_array_size, times, num_iterations);
+    free(times);
 
     fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
     fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", str_array_size/(avg_elt*1e6));
@@ -600,66 +1131,87 @@ int find_uniq_stl_sort(char *str_array, const int str_array_size,
 
 }
 
-int find_uniq_stl_map(char *str_array, int str_array_size, const int num_strings, const int num_iterations) {
+int find_uniq_stl_map(char *str_array, const int64_t str_array_size,
+        const int64_t num_strings, const int num_iterations) {
 
-    fprintf(stderr, "N %d\n", num_strings);
+    fprintf(stderr, "N %lld\n", (long long) num_strings);
     fprintf(stderr, "Using a map\n");
     fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
 
     int iter;
     double avg_elt;
 
+    /* the input is tokenized once, into lines; B, the counts and
+       everything an iteration allocates live in a sort context, which is
+       released before every iteration (sort_ctx.h) */
+    sort_ctx ctx;
+    sort_ctx_init(&ctx);
+
+    char **lines;
+    lines = (char **) sort_ctx_buffer(&ctx, num_strings, sizeof(char *));
     char **B;
-    B = (char **) malloc(num_strings * sizeof(char *));
-    assert(B != NULL);
+    B = (char **) sort_ctx_buffer(&ctx, num_strings, sizeof(char *));
+
+    int64_t *counts;
+    counts = (int64_t *) sort_ctx_buffer(&ctx, num_strings, sizeof(int64_t));
 
-    int *counts;
-    counts = (int *) malloc(num_strings * sizeof(int));
+    tokenize_lines(str_array, str_array_size, num_strings, lines);
+    sort_ctx_ready(&ctx);
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
 
     avg_elt = 0.0;
 
-    for (iter = 0; iter < num_iterations; iter++) {
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
         
-        int i, j;
-
-        B[0] = &str_array[0];
-        j = 1;
-        for (i=0; i<str_array_size-1; i++) {
-            if (str_array[i] == '\0') {
-                B[j] = &str_array[i+1];
-                j++;    
-            }
-        }
-        assert(j == num_strings);
+        int64_t i;
 
-        for (i=0; i<num_strings; i++) {
-            counts[i] = 0;
-        }
+        sort_ctx_reset(&ctx, iter);
+        scoped_phase phase(PHASE_TOKENIZE);
+
+        sort_ctx_copy(B, lines, num_strings * sizeof(char *));
+        sort_ctx_zero(counts, num_strings * sizeof(int64_t));
 
         double elt;
         elt = timer();
+        perf_begin(&pp);
+        phase.next(PHASE_COUNT);
 
-        std::map<std::string, int> str_map;
+        arena_resource res(ctx.a);
+        std::pmr::map<std::pmr::string, int64_t> str_map(&res);
 
         for (i=0; i<num_strings; i++) {
-            std::string curr_str(B[i]);
+            std::pmr::string curr_str(B[i], &res);
             //curr_str.assign(B[i], strlen(B[i]));
-            str_map[curr_str]++;
+            str_map[std::move(curr_str)]++;
         }
 
-        fprintf(stderr, "Number of unique strings: %d\n", 
-                ((int) str_map.size()));
+        fprintf(stderr, "Number of unique strings: %lld\n", 
+                ((long long) str_map.size()));
 
+        perf_phase(&pp, "insert");
+        phase.stop();
         elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
         avg_elt += elt;
         fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, num_strings);
 
     }
 
     avg_elt = avg_elt/num_iterations;
     
-    free(B);
-    free(counts);
+    sort_ctx_report(&ctx);
+    sort_ctx_free(&ctx);
+
+    perf_summary(&pp, num_strings);
+    bench_report("stl_map", num_strings, str_array_size, times, num_iterations);
+    free(times);
 
     fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
     fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", str_array_size/(avg_elt*1e6));
@@ -671,29 +1223,2425 @@ int find_uniq_stl_map(char *str_array, int str_array_size, const int num_strings
 
 }
 
-int main(int argc, char **argv) {
+/* ---------------------------------------------------------------------------
+ * Stable sort mode: duplicates keep their original line order, so the first
+ * string of every run in the sorted array is that string's first occurrence.
+ * The line index B is tokenized in line order, which is also address order,
+ * so the line number of any string is found by binary search on a copy of
+ * that order: one search per unique string, no second sort.
+ * ------------------------------------------------------------------------ */
+
+/* line number (from 0) of the string at s, given the strings in line order */
+static int64_t line_of(char *const *lines, const int64_t num_lines, const char *s) {
+    return std::lower_bound(lines, lines + num_lines, s,
+            [](const char *u, const char *v) { return u < v; }) - lines;
+}
 
-    if (argc != 4) {
-        fprintf(stderr, "%s <input file> <n> <alg_type>\n", argv[0]);
-        fprintf(stderr, "alg_type 0: use C qsort, then find unique strings\n");
-        fprintf(stderr, "         1: use inline qsort, then find unique strings\n");
-        fprintf(stderr, "         2: use STL sort, then find unique strings\n");
-        fprintf(stderr, "         3: use STL map\n");
-        exit(1);
+/* checks the stable sort: sorted, equal strings in line order, and in full
+   mode the input multiset and that run u starts at the string of
+   first_line[u] and is counts[u] long.  The per-string pass is parallel;
+   the walk over the runs is serial but only touches one string per run. */
+static void verify_stable(char *const *B, char *const *lines, const int64_t num_strings,
+        const int64_t *counts, const int64_t *first_line, const int64_t num_uniq_strings) {
+    double t0 = verify_begin();
+    const int64_t m = verify_num_checks(num_strings);
+    int64_t k, errors = 0, runs = 1;
+    uint64_t sum = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:errors,runs,sum)
+#endif
+    for (k=0; k<m; k++) {
+        int64_t i = verify_index(k, num_strings);
+        sum += verify_mix(str_hash64(B[i]));
+        if (i == 0)
+            continue;
+        int c = str_cmp(B[i-1], B[i]);
+        errors += (c > 0) || (c == 0 && B[i-1] >= B[i]);
+        runs += (c != 0);
     }
-
-    char *filename = argv[1];
+    if (verify.mode == VERIFY_FULL) {
+        errors += (sum != verify.input_sum);
+        errors += (runs != num_uniq_strings);
+        int64_t u, start = 0;
+        for (u=0; u<num_uniq_strings && errors == 0; u++) {
+            errors += (counts[u] < 1 || start + counts[u] > num_strings);
+            errors += (lines[first_line[u]] != B[start]);
+            errors += (start > 0 && str_equal(B[start-1], B[start]));
+            start += counts[u];
+        }
+        errors += (start != num_strings);
+    }
+    verify_end(t0, errors, "stable_merge_sort");
+}
+
+int find_uniq_stable(char *str_array, const int64_t str_array_size,
+        const int64_t num_strings, const int num_iterations) {
+
+    fprintf(stderr, "N %lld\n", (long long) num_strings);
+    fprintf(stderr, "Using stable merge sort, reporting first occurrences\n");
+    fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
+
+    int iter;
+    double avg_elt;
+
+    sort_ctx ctx;
+    sort_ctx_init(&ctx);
+
+    char **lines;
+    lines = (char **) sort_ctx_buffer(&ctx, num_strings, sizeof(char *));
+    char **B;
+    B = (char **) sort_ctx_buffer(&ctx, num_strings, sizeof(char *));
+
+    int64_t *counts;
+    counts = (int64_t *) sort_ctx_buffer(&ctx, num_strings, sizeof(int64_t));
+    /* first_line[u]: line of the first occurrence of the u-th unique string */
+    int64_t *first_line;
+    first_line = (int64_t *) sort_ctx_buffer(&ctx, num_strings, sizeof(int64_t));
+    int64_t num_uniq_strings = 0;
+
+    tokenize_lines(str_array, str_array_size, num_strings, lines);
+    sort_ctx_ready(&ctx);
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
+
+    avg_elt = 0.0;
+
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
+        
+        int64_t i;
+
+        sort_ctx_reset(&ctx, iter);
+        scoped_phase phase(PHASE_TOKENIZE);
+
+        sort_ctx_copy(B, lines, num_strings * sizeof(char *));
+
+        double elt;
+        elt = timer();
+        perf_begin(&pp);
+        phase.next(PHASE_SORT);
+
+        stephen_merge_sort(B, num_strings);
+        perf_phase(&pp, "sort");
+        phase.next(PHASE_COUNT);
+
+        /* count each run; its first string is the first occurrence */
+        int64_t start = 0;
+        num_uniq_strings = 0;
+        for (i=1; i<=num_strings; i++) {
+            if (i == num_strings || !str_equal(B[i], B[i-1])) {
+                counts[num_uniq_strings] = i - start;
+                first_line[num_uniq_strings] = line_of(lines, num_strings, B[start]);
+                num_uniq_strings++;
+                start = i;
+            }
+        }
+
+        perf_phase(&pp, "count");
+        phase.next(PHASE_VERIFY);
+        elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
+        avg_elt += elt;
+        fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, num_strings);
+
+        /* a complete correctness check: sorted, stable, counts add up */
+        verify_stable(B, lines, num_strings, counts, first_line, num_uniq_strings);
+    }
+
+    fprintf(stderr, "Number of unique strings: %lld\n", (long long) num_uniq_strings);
+    int64_t k;
+    for (k=0; k<num_uniq_strings && k<10; k++)
+        fprintf(stderr, "%s\tcount %lld\tfirst line %lld\n", lines[first_line[k]],
+                (long long) counts[k], (long long) first_line[k] + 1);
+
+    avg_elt = avg_elt/num_iterations;
+
+    sort_ctx_report(&ctx);
+    sort_ctx_free(&ctx);
+
+    perf_summary(&pp, num_strings);
+    bench_report("stable_merge_sort", num_strings, str_array_size, times, num_iterations);
+    free(times);
+
+    fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
+    fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", str_array_size/(avg_elt*1e6));
+    return 0;
+
+}
+
+/* ------------------------------------------------------------------------
+ * Sorted index for repeated lookups.
+ *
+ * The input is sorted and collapsed into its unique strings once, with
+ * the running line count in front of each one.  After that, every query
+ * is a range of that array:
+ *
+ *  string  or =string   exact match, the range is empty or one string
+ *  ^prefix              all strings that start with prefix
+ *
+ * and its answer is the first rank of the range, the number of unique
+ * strings in it and the number of lines (the count).
+ *
+ * The search tree holds an 8 byte prefix key of every string, taken after
+ * the prefix all strings share (IRIs all start with "<http://"), in
+ * Eytzinger order: node k has children 2k and 2k+1, so the top levels
+ * share cache lines and a line holds the 8 nodes 3 levels further down.
+ * The tree is padded to 2^depth - 1 nodes with keys that no query passes,
+ * so every lookup takes exactly depth steps and the node a lookup ends on
+ * gives the rank directly.  A query is two lookups, the lower bounds of
+ * the first key of the range and of the first key past it.  A batch of
+ * queries steps all its lookups together, one level at a time, and
+ * prefetches the line each one needs 3 levels later, so the misses of a
+ * batch overlap.
+ *
+ * Strings that share the 8 key bytes often share many more (all of
+ * "<http://dbpedia.org/ontology/").  A group of more than STR_INDEX_GROUP
+ * such strings therefore has a key of the next level, 8 bytes taken at the
+ * end of the group's own common prefix, kept in a plain sorted array: a
+ * query compares that prefix once, with the group's first string, and
+ * then searches the keys of the group.  Large groups of equal keys on that
+ * level get keys of the next one, up to STR_INDEX_LEVELS.  Strings that
+ * are still not told apart are found by binary searches on the strings.
+ * The searches on every level below the tree again run all the lookups of
+ * a batch in step.
+ * ------------------------------------------------------------------------ */
+
+#define STR_INDEX_BATCH     8       /* queries searched together */
+#define STR_INDEX_AHEAD     3       /* levels between a prefetch and its use */
+#define STR_INDEX_GROUP     16      /* smaller groups have no next level */
+#define STR_INDEX_LEVELS    4       /* levels below the tree */
+
+struct str_index {
+    char **str;             /* the unique strings, sorted */
+    int64_t *cum;           /* cum[u]: lines of the strings before str[u] */
+    int64_t num_uniq;
+    int skip;               /* length of the prefix all strings share */
+    int depth;              /* the tree has 2^depth - 1 nodes */
+    uint64_t *tree;         /* tree[1..2^depth): keys in Eytzinger order */
+    int num_levels;
+    int32_t *group_prefix[STR_INDEX_LEVELS];    /* common prefix of the group
+                                                   of str[u] on a level, or 0 */
+    uint64_t *level_key[STR_INDEX_LEVELS];      /* key of str[u] after it */
+};
+
+struct str_query {
+    const char *s;
+    int64_t len;
+    int prefix;             /* prefix range instead of exact match */
+};
+
+struct str_answer {
+    int64_t first;          /* rank of the first string of the range */
+    int64_t num_uniq;
+    int64_t num_lines;
+};
+
+/* the first (up to) 8 bytes of s[0..len), big endian, zero padded, so keys
+   compare like the strings do */
+static inline uint64_t str_prefix_key(const char *s, int64_t len) {
+    uint64_t key = 0;
+    int i;
+    for (i=0; i<8 && i<len && s[i] != '\0'; i++)
+        key |= (uint64_t) (unsigned char) s[i] << (56 - 8*i);
+    return key;
+}
+
+/* in-order rank of tree node k */
+static inline int64_t str_index_rank(const str_index *idx, uint64_t k) {
+    int d = 63 - __builtin_clzll(k);
+    return ((((int64_t) k - ((int64_t) 1 << d)) * 2 + 1) << (idx->depth - 1 - d)) - 1;
+}
+
+/* lower bounds of x[j] in a[base[j]..base[j]+len[j]), for all j in step;
+   each lookup prefetches both of its possible next probes, so the misses
+   overlap */
+static void str_key_lower_bounds(const uint64_t *a, int64_t *base, int64_t *len,
+        const uint64_t *x, const int num) {
+    int j, more = 1;
+    while (more) {
+        more = 0;
+        for (j=0; j<num; j++) {
+            if (len[j] <= 1)
+                continue;
+            const int64_t half = len[j] / 2, next = (len[j] - half) / 2;
+            __builtin_prefetch(&a[base[j] + next]);
+            __builtin_prefetch(&a[base[j] + half + next]);
+            base[j] = (a[base[j] + half - 1] < x[j]) ? base[j] + half : base[j];
+            len[j] -= half;
+            more |= (len[j] > 1);
+        }
+    }
+    for (j=0; j<num; j++)
+        base[j] += (len[j] == 1 && a[base[j]] < x[j]);
+}
+
+/* sorts B[0..n) and builds the index on it; B becomes idx->str */
+static void str_index_build(str_index *idx, sort_ctx *ctx, char **B, const int64_t n) {
+    stephen_merge_sort(B, n);
+
+    /* collapse in place, B[u] is only written after B[u] and B[u-1] are read */
+    int64_t *cum = (int64_t *) sort_ctx_buffer(ctx, n + 1, sizeof(int64_t));
+    int64_t i, m = 0;
+    for (i=0; i<n; i++) {
+        if (i == 0 || !str_equal(B[i], B[i-1])) {
+            cum[m] = i;
+            B[m++] = B[i];
+        }
+    }
+    cum[m] = n;
+
+    idx->str = B;
+    idx->cum = cum;
+    idx->num_uniq = m;
+    idx->skip = str_lcp(B[0], B[m-1]);
+
+    /* at least one padding node, so every lower bound ends on a node */
+    idx->depth = 1;
+    while (((int64_t) 1 << idx->depth) - 1 < m + 1)
+        idx->depth++;
+    const int64_t size = (int64_t) 1 << idx->depth;
+    idx->tree = (uint64_t *) sort_ctx_buffer(ctx, size, sizeof(uint64_t));
+    idx->tree[0] = 0;
+    int64_t k;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(size >= MSORT_PARALLEL_CUTOFF)
+#endif
+    for (k=1; k<size; k++) {
+        int64_t r = str_index_rank(idx, k);
+        idx->tree[k] = (r < m) ? str_prefix_key(B[r] + idx->skip, 8) : UINT64_MAX;
+    }
+
+    /* a group is a run of equal keys on the level above; a large one gets
+       its common prefix and the keys after it */
+    uint64_t *key = (uint64_t *) sort_ctx_buffer(ctx, m, sizeof(uint64_t));
+    char *group_start = (char *) sort_ctx_buffer(ctx, m, sizeof(char));
+    int64_t u;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(m >= MSORT_PARALLEL_CUTOFF)
+#endif
+    for (u=0; u<m; u++) {
+        key[u] = str_prefix_key(B[u] + idx->skip, 8);
+        group_start[u] = (u == 0) || (key[u] != str_prefix_key(B[u-1] + idx->skip, 8));
+    }
+    idx->num_levels = 0;
+    while (idx->num_levels < STR_INDEX_LEVELS) {
+        int32_t *group_prefix = (int32_t *) sort_ctx_buffer(ctx, m, sizeof(int32_t));
+        int64_t start = 0, num_groups = 0;
+        for (u=1; u<=m; u++) {
+            if (u < m && !group_start[u])
+                continue;
+            int32_t g = 0;
+            if (u - start > STR_INDEX_GROUP && (key[start] & 255) != 0) {
+                g = str_lcp(B[start], B[u-1]);
+                num_groups++;
+            }
+            for (i=start; i<u; i++)
+                group_prefix[i] = g;
+            start = u;
+        }
+        if (num_groups == 0)
+            break;
+        uint64_t *level_key = (uint64_t *) sort_ctx_buffer(ctx, m, sizeof(uint64_t));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(m >= MSORT_PARALLEL_CUTOFF)
+#endif
+        for (u=0; u<m; u++)
+            level_key[u] = (group_prefix[u] > 0) ? str_prefix_key(B[u] + group_prefix[u], 8) : 0;
+        for (u=1; u<m; u++)
+            group_start[u] |= (level_key[u] != level_key[u-1]);
+        idx->group_prefix[idx->num_levels] = group_prefix;
+        idx->level_key[idx->num_levels] = level_key;
+        idx->num_levels++;
+        key = level_key;
+    }
+}
+
+/* the binary searches on the strings in [lo[j], hi[j]), which share
+   s[0..shared[j]) with query j and go on past it, for all j with tail[j]
+   in step: a round prefetches every probe's pointer, then its string, then
+   compares.  Lookup 2j finds the first string past the query's bytes that
+   is not less than them, 2j+1 (prefixes only) the first that is greater. */
+static void str_index_search_tails(const str_index *idx, const str_query *q, const int num,
+        const int *tail, const int64_t *shared, int64_t *lo, int64_t *hi) {
+    char *const *U = idx->str;
+    int64_t base[2*STR_INDEX_BATCH], len[2*STR_INDEX_BATCH];
+    int j, more = 0;
+    for (j=0; j<2*num; j++) {
+        const int i = j / 2;
+        base[j] = lo[i];
+        len[j] = (tail[i] && (q[i].prefix || !(j & 1))) ? hi[i] - lo[i] : 0;
+        more |= (len[j] > 0);
+    }
+    while (more) {
+        for (j=0; j<2*num; j++) {
+            if (len[j] > 0)
+                __builtin_prefetch(&U[base[j] + len[j] / 2]);
+        }
+        for (j=0; j<2*num; j++) {
+            if (len[j] > 0)
+                __builtin_prefetch(U[base[j] + len[j] / 2] + shared[j / 2]);
+        }
+        more = 0;
+        for (j=0; j<2*num; j++) {
+            if (len[j] == 0)
+                continue;
+            const int i = j / 2;
+            const int64_t half = len[j] / 2, t = shared[i];
+            const char *u = U[base[j] + half] + t;
+            int c = q[i].prefix ? strncmp(u, q[i].s + t, q[i].len - t) : str_cmp(u, q[i].s + t);
+            if (c < (j & 1)) {
+                base[j] += half + 1;
+                len[j] -= half + 1;
+            } else {
+                len[j] = half;
+            }
+            more |= (len[j] > 0);
+        }
+    }
+    for (j=0; j<num; j++) {
+        if (!tail[j])
+            continue;
+        if (!q[j].prefix)
+            base[2*j+1] = base[2*j] + (base[2*j] < hi[j] &&
+                    str_equal(U[base[2*j]] + shared[j], q[j].s + shared[j]));
+        lo[j] = base[2*j];
+        hi[j] = base[2*j+1];
+    }
+}
+
+#define STR_INDEX_DONE      0
+#define STR_INDEX_LEVEL     1       /* searched on the next level */
+#define STR_INDEX_TAIL      2       /* searched on the strings */
+
+/* answers q[0..num), num <= STR_INDEX_BATCH */
+static void str_index_answer(const str_index *idx, const str_query *q, const int num,
+        str_answer *ans) {
+    const int64_t m = idx->num_uniq;
+    const int skip = idx->skip;
+    const uint64_t *tree = idx->tree;
+    char *const *U = idx->str;
+
+    /* lookup 2j finds the start of query j's range, 2j+1 its end */
+    uint64_t key[2*STR_INDEX_BATCH];
+    uint64_t node[2*STR_INDEX_BATCH];
+    int64_t base[2*STR_INDEX_BATCH], len[2*STR_INDEX_BATCH];
+    int64_t lo[STR_INDEX_BATCH], hi[STR_INDEX_BATCH];
+    int64_t shared[STR_INDEX_BATCH];    /* the range and the query share s[0..shared) */
+    int64_t next[STR_INDEX_BATCH];
+    int search[STR_INDEX_BATCH];        /* 0: answered, 1: search, 2: range ends at m */
+    int state[STR_INDEX_BATCH];
+    int j, l, level;
+
+    /* queries outside the shared prefix are answered here; the others get
+       the key of their range and the first key past it (0 if none is) */
+    for (j=0; j<num; j++) {
+        const char *s = q[j].s;
+        const int64_t len = q[j].len;
+        int c = strncmp(s, U[0], std::min(len, (int64_t) skip));
+        if (c == 0 && len < skip)
+            c = q[j].prefix ? 0 : -1;
+        key[2*j] = key[2*j+1] = 0;
+        search[j] = 0;
+        if (c < 0) {
+            lo[j] = hi[j] = 0;
+        } else if (c > 0) {
+            lo[j] = hi[j] = m;
+        } else if (q[j].prefix && len <= skip) {
+            lo[j] = 0;
+            hi[j] = m;
+        } else {
+            const int64_t r = len - skip;
+            key[2*j] = str_prefix_key(s + skip, r);
+            if (q[j].prefix && r < 8)
+                key[2*j+1] = key[2*j] + ((uint64_t) 1 << (8*(8 - r)));
+            else
+                key[2*j+1] = key[2*j] + 1;
+            search[j] = (key[2*j+1] == 0) ? 2 : 1;
+        }
+    }
+
+    /* the lower bounds, all lookups one level at a time */
+    for (j=0; j<2*num; j++)
+        node[j] = 1;
+    for (l=0; l<idx->depth; l++) {
+        for (j=0; j<2*num; j++)
+            node[j] = 2*node[j] + (tree[node[j]] < key[j]);
+        if (l + 1 + STR_INDEX_AHEAD < idx->depth) {
+            for (j=0; j<2*num; j++)
+                __builtin_prefetch(&tree[node[j] << STR_INDEX_AHEAD]);
+        }
+    }
+
+    for (j=0; j<num; j++) {
+        state[j] = STR_INDEX_DONE;
+        if (search[j] == 0)
+            continue;
+        /* the last step right climbs back to the lower bound */
+        uint64_t k = node[2*j] >> (__builtin_ctzll(~node[2*j]) + 1);
+        lo[j] = std::min(str_index_rank(idx, k), m);
+        k = node[2*j+1] >> (__builtin_ctzll(~node[2*j+1]) + 1);
+        hi[j] = (search[j] == 2) ? m : std::min(str_index_rank(idx, k), m);
+        /* the strings of a key without '\0' differ after the key */
+        if ((key[2*j] & 255) != 0 && (!q[j].prefix || q[j].len - skip > 8)) {
+            state[j] = STR_INDEX_LEVEL;
+            shared[j] = skip + 8;
+        }
+    }
+
+    /* the levels below, again with all lookups in step */
+    for (level=0; level<idx->num_levels; level++) {
+        const int32_t *group_prefix = idx->group_prefix[level];
+        int active = 0;
+        for (j=0; j<num; j++) {
+            if (state[j] == STR_INDEX_LEVEL && lo[j] < hi[j]) {
+                __builtin_prefetch(&group_prefix[lo[j]]);
+                __builtin_prefetch(&U[lo[j]]);
+            }
+        }
+        for (j=0; j<num; j++) {
+            base[2*j] = base[2*j+1] = 0;
+            len[2*j] = len[2*j+1] = 0;
+            if (state[j] != STR_INDEX_LEVEL)
+                continue;
+            const int64_t a = lo[j], b = hi[j];
+            if (a == b || group_prefix[a] == 0) {
+                state[j] = (a == b) ? STR_INDEX_DONE : STR_INDEX_TAIL;
+                continue;
+            }
+            /* the group's common prefix, compared once */
+            const char *s = q[j].s;
+            const int64_t g = group_prefix[a], t = shared[j];
+            int c = strncmp(s + t, U[a] + t, (q[j].prefix ? std::min(q[j].len, g) : g) - t);
+            if (c != 0) {
+                lo[j] = hi[j] = (c < 0) ? a : b;
+                state[j] = STR_INDEX_DONE;
+                continue;
+            }
+            if (q[j].prefix && q[j].len <= g) {
+                state[j] = STR_INDEX_DONE;
+                continue;
+            }
+            const int64_t r = q[j].len - g;
+            key[2*j] = str_prefix_key(s + g, r);
+            if (q[j].prefix && r < 8)
+                key[2*j+1] = key[2*j] + ((uint64_t) 1 << (8*(8 - r)));
+            else
+                key[2*j+1] = key[2*j] + 1;
+            base[2*j] = base[2*j+1] = a;
+            len[2*j] = b - a;
+            len[2*j+1] = (key[2*j+1] != 0) ? b - a : 0;
+            if (key[2*j+1] == 0)
+                base[2*j+1] = b;
+            next[j] = ((key[2*j] & 255) != 0 && (!q[j].prefix || r > 8)) ? g + 8 : 0;
+            active = 1;
+        }
+        if (!active)
+            break;
+        str_key_lower_bounds(idx->level_key[level], base, len, key, 2*num);
+        for (j=0; j<num; j++) {
+            if (state[j] != STR_INDEX_LEVEL)
+                continue;
+            lo[j] = base[2*j];
+            hi[j] = base[2*j+1];
+            shared[j] = next[j];
+            state[j] = (next[j] > 0) ? STR_INDEX_LEVEL : STR_INDEX_DONE;
+        }
+    }
+
+    for (j=0; j<num; j++)
+        state[j] = (state[j] != STR_INDEX_DONE && lo[j] < hi[j]);
+    str_index_search_tails(idx, q, num, state, shared, lo, hi);
+
+    for (j=0; j<num; j++) {
+        ans[j].first = lo[j];
+        ans[j].num_uniq = hi[j] - lo[j];
+        ans[j].num_lines = idx->cum[hi[j]] - idx->cum[lo[j]];
+    }
+}
+
+static void str_index_answer_all(const str_index *idx, const str_query *q,
+        const int64_t num_queries, str_answer *ans) {
+    const int64_t num_batches = (num_queries + STR_INDEX_BATCH - 1) / STR_INDEX_BATCH;
+    int64_t b;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(num_queries >= MSORT_PARALLEL_CUTOFF)
+#endif
+    for (b=0; b<num_batches; b++) {
+        int64_t first = b * STR_INDEX_BATCH;
+        int num = (int) std::min((int64_t) STR_INDEX_BATCH, num_queries - first);
+        str_index_answer(idx, q + first, num, ans + first);
+    }
+}
+
+/* one query per line: string or =string, ^prefix */
+static str_query *str_index_read_queries(const char *filename, char **buf,
+        int64_t *num_queries) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Couldn't open query file!\n");
+        exit(2);
+    }
+    struct stat file_stat;
+    fstat(fileno(fp), &file_stat);
+    const int64_t size = file_stat.st_size;
+    *buf = (char *) alloc_array(size + 1, sizeof(char));
+    if (fread(*buf, sizeof(char), size, fp) != (size_t) size) {
+        fprintf(stderr, "Error: Couldn't read query file!\n");
+        exit(2);
+    }
+    fclose(fp);
+    (*buf)[size] = '\n';
+
+    int64_t i, n = 0;
+    for (i=0; i<size; i++)
+        n += ((*buf)[i] == '\n');
+    str_query *q = (str_query *) alloc_array(n + 1, sizeof(str_query));
+    char *s = *buf;
+    n = 0;
+    for (i=0; i<=size; i++) {
+        if ((*buf)[i] != '\n')
+            continue;
+        (*buf)[i] = '\0';
+        if (i < size || s < &(*buf)[i]) {
+            q[n].prefix = (s[0] == '^');
+            if (s[0] == '^' || s[0] == '=')
+                s++;
+            q[n].s = s;
+            q[n].len = &(*buf)[i] - s;
+            n++;
+        }
+        s = &(*buf)[i+1];
+    }
+    *num_queries = n;
+    return q;
+}
+
+/* checks that the strings are unique and sorted and the counts add up */
+static void verify_str_index(const str_index *idx, const int64_t num_strings) {
+    if (verify.mode != VERIFY_FULL)
+        return;
+    double t0 = verify_begin();
+    char *const *U = idx->str;
+    const int64_t m = idx->num_uniq;
+    int64_t u, errors = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:errors)
+#endif
+    for (u=1; u<m; u++)
+        errors += (str_cmp(U[u-1], U[u]) >= 0 || idx->cum[u] <= idx->cum[u-1]);
+    errors += (idx->cum[0] != 0 || idx->cum[m] != num_strings);
+    verify_end(t0, errors, "sorted_index build");
+}
+
+/* checks every answer (or a sample) against binary searches on the whole
+   array */
+static void verify_queries(const str_index *idx, const str_query *q, const int64_t num_queries,
+        const str_answer *ans) {
+    double t0 = verify_begin();
+    char *const *U = idx->str;
+    const int64_t m = idx->num_uniq;
+    const int64_t checks = verify_num_checks(num_queries);
+    int64_t k, errors = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:errors)
+#endif
+    for (k=0; k<checks; k++) {
+        int64_t i = verify_index(k, num_queries);
+        const char *s = q[i].s;
+        const size_t len = q[i].len;
+        int64_t lo, hi;
+        if (q[i].prefix) {
+            lo = std::partition_point(U, U + m,
+                    [s, len](const char *u) { return strncmp(u, s, len) < 0; }) - U;
+            hi = std::partition_point(U + lo, U + m,
+                    [s, len](const char *u) { return strncmp(u, s, len) == 0; }) - U;
+        } else {
+            lo = std::lower_bound(U, U + m, s,
+                    [](const char *u, const char *v) { return str_cmp(u, v) < 0; }) - U;
+            hi = lo + (lo < m && str_equal(U[lo], s));
+        }
+        errors += (ans[i].first != lo || ans[i].num_uniq != hi - lo ||
+                ans[i].num_lines != idx->cum[hi] - idx->cum[lo]);
+    }
+    verify_end(t0, errors, "sorted_index");
+}
+
+int find_uniq_index(char *str_array, const int64_t str_array_size,
+        const int64_t num_strings, const int num_iterations, const char *query_file) {
+
+    fprintf(stderr, "N %lld\n", (long long) num_strings);
+    fprintf(stderr, "Using sorted index, answering exact-match and prefix queries\n");
+
+    int iter;
+    double avg_elt;
+
+    sort_ctx ctx;
+    sort_ctx_init(&ctx);
+
+    char **lines;
+    lines = (char **) sort_ctx_buffer(&ctx, num_strings, sizeof(char *));
+    char **B;
+    B = (char **) sort_ctx_buffer(&ctx, num_strings, sizeof(char *));
+
+    scoped_phase phase(PHASE_TOKENIZE);
+    tokenize_lines(str_array, str_array_size, num_strings, lines);
+
+    /* without a query file every line is a query: an exact match, or on
+       odd lines a prefix range of its first half */
+    char *query_buf = NULL;
+    str_query *queries;
+    int64_t num_queries, query_bytes = 0;
+    int64_t i;
+    if (query_file != NULL) {
+        queries = str_index_read_queries(query_file, &query_buf, &num_queries);
+    } else {
+        num_queries = num_strings;
+        queries = (str_query *) alloc_array(num_queries, sizeof(str_query));
+        for (i=0; i<num_queries; i++) {
+            queries[i].s = lines[i];
+            queries[i].len = strlen(lines[i]);
+            queries[i].prefix = (i & 1);
+            if (queries[i].prefix)
+                queries[i].len /= 2;
+        }
+    }
+    for (i=0; i<num_queries; i++)
+        query_bytes += queries[i].len + 1;
+    str_answer *ans = (str_answer *) sort_ctx_buffer(&ctx, num_queries, sizeof(str_answer));
+
+    /* the index is built once, outside the timed queries */
+    phase.next(PHASE_SORT);
+    double elt;
+    elt = timer();
+    sort_ctx_copy(B, lines, num_strings * sizeof(char *));
+    str_index idx;
+    str_index_build(&idx, &ctx, B, num_strings);
+    elt = timer() - elt;
+    phase.stop();
+    sort_ctx_ready(&ctx);
+    fprintf(stderr, "Index build: %9.3lf ms, %lld unique strings, shared prefix %d, "
+            "tree depth %d, %d levels below\n",
+            elt*1e3, (long long) idx.num_uniq, idx.skip, idx.depth, idx.num_levels);
+    verify_str_index(&idx, num_strings);
+
+    fprintf(stderr, "Queries: %lld\n", (long long) num_queries);
+    fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
+
+    avg_elt = 0.0;
+
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
+
+        sort_ctx_reset(&ctx, iter);
+        scoped_phase phase(PHASE_COUNT);
+
+        elt = timer();
+        perf_begin(&pp);
+
+        str_index_answer_all(&idx, queries, num_queries, ans);
+
+        perf_phase(&pp, "query");
+        phase.next(PHASE_VERIFY);
+        elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
+        avg_elt += elt;
+        fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, num_queries);
+
+        /* a complete correctness check against plain binary searches */
+        verify_queries(&idx, queries, num_queries, ans);
+    }
+
+    int64_t hits = 0, lines_matched = 0;
+    for (i=0; i<num_queries; i++) {
+        hits += (ans[i].num_uniq > 0);
+        lines_matched += ans[i].num_lines;
+    }
+    fprintf(stderr, "Queries with matches: %lld, lines matched: %lld\n",
+            (long long) hits, (long long) lines_matched);
+    for (i=0; i<num_queries && i<10; i++)
+        fprintf(stderr, "%s%.*s\tfirst %lld\tunique %lld\tcount %lld\n",
+                queries[i].prefix ? "^" : "", (int) queries[i].len, queries[i].s,
+                (long long) ans[i].first, (long long) ans[i].num_uniq,
+                (long long) ans[i].num_lines);
+
+    avg_elt = avg_elt/num_iterations;
+
+    sort_ctx_report(&ctx);
+    sort_ctx_free(&ctx);
+    free(queries);
+    free(query_buf);
+
+    perf_summary(&pp, num_queries);
+    bench_report("sorted_index", num_queries, query_bytes, times, num_iterations);
+    free(times);
+
+    fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
+    fprintf(stderr, "Average query rate: %6.3lf Mqueries/s\n", num_queries/(avg_elt*1e6));
+    return 0;
+
+}
+
+/* ------------------------------------------------------------------------
+ * External (out-of-core) unique counting.
+ *
+ * The input is streamed in chunks that fit in mem_limit bytes.  Each chunk
+ * is sorted, collapsed into (string, count) records and spilled to disk as
+ * a sorted run.  The runs are then k-way merged by the LCP loser tree,
+ * summing the counts of equal strings.  Every reader keeps the record before
+ * its current one, whose common prefix with the current record is the lcp
+ * the tree needs.  If there are more runs than we can hold open buffers
+ * for, the runs are merged in several passes.
+ *
+ * Run record format: int64 count, uint32 length, length bytes (no '\0').
+ * ------------------------------------------------------------------------ */
+
+#define EXT_RUN_BUFFER_BYTES (1 << 16)  /* stdio buffer per open run */
+
+static FILE *ext_open_run(const char *tmp_dir) {
+    if (tmp_dir == NULL)
+        return tmpfile();
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/uniq_str_run_XXXXXX", tmp_dir);
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return NULL;
+    unlink(path);   /* the run disappears as soon as it is closed */
+    return fdopen(fd, "w+b");
+}
+
+/* a failed write (a full disk) would silently drop records, so it ends
+   the program */
+static void ext_write_failed(void) {
+    fprintf(stderr, "Error: Couldn't write run file: %s!\n", strerror(errno));
+    exit(2);
+}
+
+static void ext_write_record(FILE *fp, const char *s, uint32_t len, int64_t count) {
+    if (fwrite(&count, sizeof(count), 1, fp) != 1 ||
+            fwrite(&len, sizeof(len), 1, fp) != 1 ||
+            fwrite(s, 1, len, fp) != len)
+        ext_write_failed();
+}
+
+static void ext_flush_run(FILE *fp) {
+    if (fflush(fp) != 0 || ferror(fp))
+        ext_write_failed();
+}
+
+struct ext_run_reader {
+    FILE *fp;
+    char *iobuf;
+    char *str;          /* current string, '\0' terminated */
+    uint32_t len;
+    uint32_t cap;
+    int64_t count;
+    char *prev;         /* previous string of this run */
+    uint32_t prev_cap;
+    int lcp;            /* of str and prev (0 for the first record) */
+    int done;
+    int64_t records;
+    const char *name;   /* for errors; NULL for a run */
+};
+
+/* a record cut short is a truncated or damaged file, not its end */
+static void ext_read_failed(const ext_run_reader *r) {
+    fprintf(stderr, "Error: %s is truncated or unreadable (after %lld records)!\n",
+            (r->name != NULL) ? r->name : "run file", (long long) r->records);
+    exit(2);
+}
+
+/* advance to the next record; returns 0 at the end of the run */
+static int ext_run_next(ext_run_reader *r) {
+    char *tmp = r->prev;
+    uint32_t tmp_cap = r->prev_cap;
+    r->prev = r->str;
+    r->prev_cap = r->cap;
+    r->str = tmp;
+    r->cap = tmp_cap;
+
+    r->done = 1;
+    size_t got = fread(&r->count, 1, sizeof(r->count), r->fp);
+    if (got == 0 && feof(r->fp) && !ferror(r->fp))
+        return 0;
+    if (got != sizeof(r->count) || fread(&r->len, sizeof(r->len), 1, r->fp) != 1)
+        ext_read_failed(r);
+    if (r->len + 1 > r->cap) {
+        r->cap = 2 * (r->len + 1);
+        r->str = (char *) realloc(r->str, r->cap);
+        assert(r->str != NULL);
+    }
+    if (r->len > 0 && fread(r->str, 1, r->len, r->fp) != r->len)
+        ext_read_failed(r);
+    r->str[r->len] = '\0';
+    r->lcp = (r->records > 0) ? str_lcp(r->prev, r->str) : 0;
+    r->records++;
+    r->done = 0;
+    return 1;
+}
+
+/* sort a chunk of strings and spill it as one run of (string, count) records */
+static FILE *ext_spill_run(char **ptrs, int64_t num_ptrs, const char *tmp_dir,
+        int64_t *num_records) {
+
+    compare_str_cmpf cmpf;
+    std::sort(ptrs, ptrs + num_ptrs, cmpf);
+
+    FILE *fp = ext_open_run(tmp_dir);
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Couldn't create run file!\n");
+        exit(2);
+    }
+
+    int64_t records = 0;
+    int64_t i = 0;
+    while (i < num_ptrs) {
+        int64_t j = i + 1;
+        while (j < num_ptrs && str_equal(ptrs[j], ptrs[i]))
+            j++;
+        ext_write_record(fp, ptrs[i], (uint32_t) strlen(ptrs[i]), j - i);
+        records++;
+        i = j;
+    }
+    ext_flush_run(fp);
+    *num_records = records;
+    return fp;
+}
+
+/* k-way merge runs[0..num_runs) into out (if not NULL), summing counts.
+ * Returns the number of unique strings; *total gets the sum of counts. */
+static int64_t ext_merge_runs(FILE **runs, int num_runs, FILE *out, int64_t *total) {
+
+    ext_run_reader *readers = (ext_run_reader *) calloc(num_runs, sizeof(ext_run_reader));
+    assert(readers != NULL);
+
+    int i;
+    for (i=0; i<num_runs; i++) {
+        readers[i].fp = runs[i];
+        readers[i].iobuf = (char *) malloc(EXT_RUN_BUFFER_BYTES);
+        assert(readers[i].iobuf != NULL);
+        rewind(runs[i]);
+        setvbuf(runs[i], readers[i].iobuf, _IOFBF, EXT_RUN_BUFFER_BYTES);
+        ext_run_next(&readers[i]);
+    }
+
+    lcp_loser_tree<ext_run_reader> tree;
+    lcp_tree_init(&tree, readers, num_runs);
+
+    int64_t num_uniq_strings = 0;
+    int64_t total_strings = 0;
+    char *curr = NULL;
+    uint32_t curr_len = 0;
+    uint32_t curr_cap = 0;
+    int64_t curr_count = 0;
+
+    int top;
+    while ((top = lcp_tree_top(&tree)) >= 0) {
+        ext_run_reader *r = &readers[top];
+
+        /* r->lcp is relative to the last output, which equals curr: only
+           the bytes past it are compared or copied */
+        if (curr_count > 0 && r->lcp == (int) curr_len && r->len == curr_len) {
+            curr_count += r->count;
+        } else {
+            if (curr_count > 0 && out != NULL)
+                ext_write_record(out, curr, curr_len, curr_count);
+            if (r->len + 1 > curr_cap) {
+                curr_cap = 2 * (r->len + 1);
+                curr = (char *) realloc(curr, curr_cap);
+                assert(curr != NULL);
+            }
+            memcpy(curr + r->lcp, r->str + r->lcp, r->len - r->lcp + 1);
+            curr_len = r->len;
+            curr_count = r->count;
+            num_uniq_strings++;
+        }
+        total_strings += r->count;
+
+        ext_run_next(r);
+        lcp_tree_replay(&tree);
+    }
+    lcp_tree_free(&tree);
+    if (curr_count > 0 && out != NULL)
+        ext_write_record(out, curr, curr_len, curr_count);
+
+    for (i=0; i<num_runs; i++) {
+        fclose(readers[i].fp);
+        free(readers[i].iobuf);
+        free(readers[i].str);
+        free(readers[i].prev);
+    }
+    free(readers);
+    free(curr);
+
+    *total = total_strings;
+    return num_uniq_strings;
+}
+
+int find_uniq_external(const char *filename, const int64_t file_size_bytes,
+        const int64_t num_strings, const int64_t mem_limit, const char *tmp_dir) {
+
+    fprintf(stderr, "N %lld\n", (long long) num_strings);
+    fprintf(stderr, "Using external sort + merge, memory limit %lld MB\n",
+            (long long) (mem_limit >> 20));
+
+    FILE *infp = fopen(filename, "r");
+    if (infp == NULL) {
+        fprintf(stderr, "Error: Couldn't open file!\n");
+        exit(2);
+    }
+
+    /* one allocation holds the chunk: string bytes grow up from the start,
+       string pointers grow down from the (pointer aligned) end */
+    char *chunk = (char *) malloc(mem_limit);
+    assert(chunk != NULL);
+    char **ptr_end = (char **) (chunk + (mem_limit & ~((int64_t) sizeof(char *) - 1)));
+
+    std::vector<FILE *> runs;
+    int64_t num_run_records = 0;
+
+    double elt;
+    elt = timer();
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    char *str_top = chunk;
+    char **ptr_top = ptr_end;
+    int64_t lines_read = 0;
+
+    while ((line_len = getline(&line, &line_cap, infp)) >= 0) {
+        if (line_len > 0 && line[line_len-1] == '\n')
+            line_len--;
+
+        /* spill the current chunk if this string and its pointer don't fit */
+        if (str_top + line_len + 1 > (char *) (ptr_top - 1)) {
+            if (ptr_top == ptr_end) {
+                fprintf(stderr, "Error: memory limit is smaller than a single line!\n");
+                exit(2);
+            }
+            int64_t records;
+            runs.push_back(ext_spill_run(ptr_top, ptr_end - ptr_top, tmp_dir, &records));
+            num_run_records += records;
+            str_top = chunk;
+            ptr_top = ptr_end;
+        }
+
+        memcpy(str_top, line, line_len);
+        str_top[line_len] = '\0';
+        *(--ptr_top) = str_top;
+        str_top += line_len + 1;
+        lines_read++;
+    }
+    if (ptr_top != ptr_end) {
+        int64_t records;
+        runs.push_back(ext_spill_run(ptr_top, ptr_end - ptr_top, tmp_dir, &records));
+        num_run_records += records;
+    }
+    free(line);
+    fclose(infp);
+
+    fprintf(stderr, "num strings read %lld\n", (long long) lines_read);
+    assert(num_strings == lines_read);
+
+    /* the chunk memory is handed over to the run buffers during merging */
+    free(chunk);
+
+    int num_initial_runs = (int) runs.size();
+    int max_fan_in = (int) (mem_limit / (2 * EXT_RUN_BUFFER_BYTES));
+    if (max_fan_in < 2)
+        max_fan_in = 2;
+
+    /* intermediate passes until all runs can be merged at once */
+    int num_passes = 1;
+    while ((int) runs.size() > max_fan_in) {
+        std::vector<FILE *> next_runs;
+        size_t r;
+        for (r=0; r<runs.size(); r+=max_fan_in) {
+            int fan_in = (int) std::min((size_t) max_fan_in, runs.size() - r);
+            FILE *out = ext_open_run(tmp_dir);
+            if (out == NULL) {
+                fprintf(stderr, "Error: Couldn't create run file!\n");
+                exit(2);
+            }
+            int64_t total;
+            ext_merge_runs(&runs[r], fan_in, out, &total);
+            ext_flush_run(out);
+            next_runs.push_back(out);
+        }
+        runs.swap(next_runs);
+        num_passes++;
+    }
+
+    int64_t total_strings = 0;
+    int64_t num_uniq_strings = 0;
+    if (!runs.empty())
+        num_uniq_strings = ext_merge_runs(&runs[0], (int) runs.size(), NULL, &total_strings);
+
+    elt = timer() - elt;
+
+    assert(total_strings == lines_read);
+
+    fprintf(stderr, "Runs spilled: %d (%lld records), merge passes: %d\n",
+            num_initial_runs, (long long) num_run_records, num_passes);
+    fprintf(stderr, "Number of unique strings: %lld\n", (long long) num_uniq_strings);
+    bench_report("external", num_strings, file_size_bytes, &elt, 1);
+    fprintf(stderr, "Time: %9.3lf ms.\n", elt*1e3);
+    fprintf(stderr, "Sort rate: %6.3lf MB/s\n", file_size_bytes/(elt*1e6));
+
+    return 0;
+
+}
+
+/* ------------------------------------------------------------------------
+ * Approximate distinct count and heavy hitters.
+ *
+ * One pass over the line index with fixed memory per thread:
+ *   - HyperLogLog (2^HLL_P registers) for the number of unique strings,
+ *   - SpaceSaving (SS_CAPACITY counters) to nominate heavy hitter candidates,
+ *   - Count-Min (CM_DEPTH x CM_WIDTH) to estimate the candidates' counts.
+ * Every thread fills its own sketches; they are merged at the end.
+ * ------------------------------------------------------------------------ */
+
+#define HLL_P       14
+#define HLL_M       (1 << HLL_P)
+#define CM_DEPTH    4
+#define CM_WIDTH    (1 << 16)
+#define SS_CAPACITY 1024
+#define SS_SLOTS    (4 * SS_CAPACITY)   /* power of two */
+
+struct ss_entry {
+    uint64_t hash;
+    const char *str;
+    int64_t count;
+    int64_t err;        /* count may overestimate the true count by up to err */
+    int slot;           /* its slot in ss_slot */
+};
+
+struct uniq_sketch {
+    uint8_t hll[HLL_M];
+    uint32_t cm[CM_DEPTH][CM_WIDTH];
+    /* SpaceSaving counters kept as a binary min-heap on count */
+    ss_entry ss[SS_CAPACITY];
+    int ss_size;
+    int64_t ss_floor;   /* a string without a counter occurs at most this often */
+    /* linear probing on the hash, heap position + 1 (0: empty); strings with
+       the same hash are told apart by comparing them */
+    int32_t ss_slot[SS_SLOTS];
+};
+
+static void ss_clear(uniq_sketch *sk) {
+    sk->ss_size = 0;
+    sk->ss_floor = 0;
+    memset(sk->ss_slot, 0, sizeof(sk->ss_slot));
+}
+
+/* heap position of str's counter, or -1 */
+static int ss_find(const uniq_sketch *sk, uint64_t hash, const char *str) {
+    uint32_t s = (uint32_t) hash & (SS_SLOTS - 1);
+    while (sk->ss_slot[s] != 0) {
+        const ss_entry *e = &sk->ss[sk->ss_slot[s] - 1];
+        if (e->hash == hash && str_cmp(e->str, str) == 0)
+            return sk->ss_slot[s] - 1;
+        s = (s + 1) & (SS_SLOTS - 1);
+    }
+    return -1;
+}
+
+static void ss_slot_insert(uniq_sketch *sk, int i) {
+    uint32_t s = (uint32_t) sk->ss[i].hash & (SS_SLOTS - 1);
+    while (sk->ss_slot[s] != 0)
+        s = (s + 1) & (SS_SLOTS - 1);
+    sk->ss_slot[s] = i + 1;
+    sk->ss[i].slot = s;
+}
+
+/* empties the slot of the counter at i, shifting back the slots after it
+   that would no longer be reached from their home slot */
+static void ss_slot_remove(uniq_sketch *sk, int i) {
+    uint32_t hole = sk->ss[i].slot, s = hole;
+    sk->ss_slot[hole] = 0;
+    for (;;) {
+        s = (s + 1) & (SS_SLOTS - 1);
+        if (sk->ss_slot[s] == 0)
+            return;
+        ss_entry *e = &sk->ss[sk->ss_slot[s] - 1];
+        uint32_t home = (uint32_t) e->hash & (SS_SLOTS - 1);
+        if (((s - home) & (SS_SLOTS - 1)) >= ((s - hole) & (SS_SLOTS - 1))) {
+            sk->ss_slot[hole] = sk->ss_slot[s];
+            sk->ss_slot[s] = 0;
+            e->slot = hole;
+            hole = s;
+        }
+    }
+}
+
+static void ss_swap(uniq_sketch *sk, int a, int b) {
+    ss_entry tmp = sk->ss[a];
+    sk->ss[a] = sk->ss[b];
+    sk->ss[b] = tmp;
+    sk->ss_slot[sk->ss[a].slot] = a + 1;
+    sk->ss_slot[sk->ss[b].slot] = b + 1;
+}
+
+static void ss_sift_down(uniq_sketch *sk, int i) {
+    for (;;) {
+        int smallest = i;
+        int l = 2*i + 1;
+        int r = 2*i + 2;
+        if (l < sk->ss_size && sk->ss[l].count < sk->ss[smallest].count)
+            smallest = l;
+        if (r < sk->ss_size && sk->ss[r].count < sk->ss[smallest].count)
+            smallest = r;
+        if (smallest == i)
+            return;
+        ss_swap(sk, i, smallest);
+        i = smallest;
+    }
+}
+
+static void ss_sift_up(uniq_sketch *sk, int i) {
+    while (i > 0 && sk->ss[(i-1)/2].count > sk->ss[i].count) {
+        ss_swap(sk, i, (i-1)/2);
+        i = (i-1)/2;
+    }
+}
+
+static void ss_add(uniq_sketch *sk, uint64_t hash, const char *str) {
+    int i = ss_find(sk, hash, str);
+    if (i >= 0) {
+        sk->ss[i].count++;
+        ss_sift_down(sk, i);
+    } else if (sk->ss_size < SS_CAPACITY) {
+        i = sk->ss_size++;
+        sk->ss[i].hash = hash;
+        sk->ss[i].str = str;
+        sk->ss[i].count = 1;
+        sk->ss[i].err = 0;
+        ss_slot_insert(sk, i);
+        ss_sift_up(sk, i);
+    } else {
+        /* evict the minimum; the newcomer inherits its count as error */
+        int64_t min_count = sk->ss[0].count;
+        ss_slot_remove(sk, 0);
+        sk->ss[0].hash = hash;
+        sk->ss[0].str = str;
+        sk->ss[0].count = min_count + 1;
+        sk->ss[0].err = min_count;
+        ss_slot_insert(sk, 0);
+        sk->ss_floor = min_count;
+        ss_sift_down(sk, 0);
+    }
+}
+
+static inline void sketch_add(uniq_sketch *sk, const char *str) {
+    uint64_t h = str_hash64(str);
+
+    /* HyperLogLog: top HLL_P bits pick the register, the rest the rank */
+    uint32_t reg = (uint32_t) (h >> (64 - HLL_P));
+    uint64_t rest = (h << HLL_P) | (1ULL << (HLL_P - 1));
+    uint8_t rank = (uint8_t) (__builtin_clzll(rest) + 1);
+    if (rank > sk->hll[reg])
+        sk->hll[reg] = rank;
+
+    /* Count-Min: CM_DEPTH hash functions derived from two halves of h */
+    uint32_t h1 = (uint32_t) h;
+    uint32_t h2 = (uint32_t) (h >> 32);
+    int d;
+    for (d=0; d<CM_DEPTH; d++)
+        sk->cm[d][(h1 + d * h2) & (CM_WIDTH - 1)]++;
+
+    ss_add(sk, h, str);
+}
+
+static uint64_t sketch_cm_estimate(const uniq_sketch *sk, uint64_t h) {
+    uint32_t h1 = (uint32_t) h;
+    uint32_t h2 = (uint32_t) (h >> 32);
+    uint64_t est = sk->cm[0][h1 & (CM_WIDTH - 1)];
+    int d;
+    for (d=1; d<CM_DEPTH; d++) {
+        uint64_t c = sk->cm[d][(h1 + d * h2) & (CM_WIDTH - 1)];
+        if (c < est)
+            est = c;
+    }
+    return est;
+}
+
+static double sketch_hll_estimate(const uniq_sketch *sk) {
+    double sum = 0.0;
+    int zeros = 0;
+    int i;
+    for (i=0; i<HLL_M; i++) {
+        sum += 1.0 / ((double) (1ULL << sk->hll[i]));
+        if (sk->hll[i] == 0)
+            zeros++;
+    }
+    double alpha = 0.7213 / (1.0 + 1.079 / HLL_M);
+    double est = alpha * HLL_M * (double) HLL_M / sum;
+    /* small range correction: linear counting */
+    if (est <= 2.5 * HLL_M && zeros > 0)
+        est = HLL_M * log((double) HLL_M / zeros);
+    return est;
+}
+
+/* merge src into dst: registers take the max, counters add up.  A string
+   counted on one side only gets the other side's floor, the most it can
+   have occurred there unseen.  Of the merged counters the SS_CAPACITY
+   largest are kept, and the largest one dropped raises the floor. */
+static void sketch_merge(uniq_sketch *dst, const uniq_sketch *src) {
+    int i, d;
+    for (i=0; i<HLL_M; i++) {
+        if (src->hll[i] > dst->hll[i])
+            dst->hll[i] = src->hll[i];
+    }
+    for (d=0; d<CM_DEPTH; d++) {
+        for (i=0; i<CM_WIDTH; i++)
+            dst->cm[d][i] += src->cm[d][i];
+    }
+
+    std::vector<ss_entry> all(dst->ss, dst->ss + dst->ss_size);
+    std::vector<char> matched(src->ss_size, 0);
+    for (i=0; i<(int) all.size(); i++) {
+        int j = ss_find(src, all[i].hash, all[i].str);
+        if (j >= 0) {
+            all[i].count += src->ss[j].count;
+            all[i].err += src->ss[j].err;
+            matched[j] = 1;
+        } else {
+            all[i].count += src->ss_floor;
+            all[i].err += src->ss_floor;
+        }
+    }
+    for (i=0; i<src->ss_size; i++) {
+        if (matched[i])
+            continue;
+        ss_entry e = src->ss[i];
+        e.count += dst->ss_floor;
+        e.err += dst->ss_floor;
+        all.push_back(e);
+    }
+
+    int64_t floor = dst->ss_floor + src->ss_floor;
+    if (all.size() > SS_CAPACITY) {
+        std::nth_element(all.begin(), all.begin() + SS_CAPACITY, all.end(),
+                [](const ss_entry &u, const ss_entry &v) { return u.count > v.count; });
+        floor = std::max(floor, all[SS_CAPACITY].count);
+        all.resize(SS_CAPACITY);
+    }
+
+    ss_clear(dst);
+    dst->ss_floor = floor;
+    for (i=0; i<(int) all.size(); i++) {
+        dst->ss[i] = all[i];
+        ss_slot_insert(dst, i);
+    }
+    dst->ss_size = (int) all.size();
+    for (i=dst->ss_size/2 - 1; i>=0; i--)
+        ss_sift_down(dst, i);
+}
+
+/* candidates by Count-Min estimate, largest first */
+class compare_est_cmpf {
+    public:
+        bool operator() (const std::pair<uint64_t, const char *> &u,
+                const std::pair<uint64_t, const char *> &v) {
+            if (u.first != v.first)
+                return u.first > v.first;
+            return str_cmp(u.second, v.second) < 0;
+        }
+};
+
+int find_uniq_sketch(char *str_array, const int64_t str_array_size,
+        const int64_t num_strings, const int num_iterations, const int top_k) {
+
+    fprintf(stderr, "N %lld\n", (long long) num_strings);
+    fprintf(stderr, "Using HyperLogLog + Count-Min/SpaceSaving sketches, top %d\n", top_k);
+    fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
+
+    int iter;
+    double avg_elt;
+
+    char **B;
+    B = (char **) alloc_array(num_strings, sizeof(char *));
+
+    int num_threads = 1;
+#ifdef _OPENMP
+    num_threads = omp_get_max_threads();
+#endif
+    uniq_sketch **sketches = new uniq_sketch*[num_threads];
+    int t;
+    for (t=0; t<num_threads; t++)
+        sketches[t] = new uniq_sketch;
+
+    std::vector<std::pair<uint64_t, const char *> > top;
+    double est_uniq = 0.0;
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
+
+    avg_elt = 0.0;
+
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
+        
+        int64_t i;
+
+        scoped_phase phase(PHASE_TOKENIZE);
+
+        tokenize_lines(str_array, str_array_size, num_strings, B);
+
+        for (t=0; t<num_threads; t++) {
+            memset(sketches[t]->hll, 0, sizeof(sketches[t]->hll));
+            memset(sketches[t]->cm, 0, sizeof(sketches[t]->cm));
+            ss_clear(sketches[t]);
+        }
+
+        double elt;
+        elt = timer();
+        perf_begin(&pp);
+        phase.next(PHASE_COUNT);
+
+#pragma omp parallel for schedule(static)
+        for (t=0; t<num_threads; t++) {
+#ifdef _OPENMP
+            scoped_phase thread_phase(PHASE_COUNT);
+#endif
+            int64_t start_position = (num_strings * t) / num_threads;
+            int64_t end_position = (num_strings * (t+1)) / num_threads;
+            int64_t k;
+            for (k=start_position; k<end_position; k++)
+                sketch_add(sketches[t], B[k]);
+        }
+
+        perf_phase(&pp, "sketch");
+        for (t=1; t<num_threads; t++)
+            sketch_merge(sketches[0], sketches[t]);
+
+        est_uniq = sketch_hll_estimate(sketches[0]);
+
+        top.clear();
+        for (i=0; i<sketches[0]->ss_size; i++) {
+            const ss_entry *e = &sketches[0]->ss[i];
+            top.push_back(std::make_pair(sketch_cm_estimate(sketches[0], e->hash), e->str));
+        }
+        compare_est_cmpf cmpf;
+        int num_top = std::min((int) top.size(), top_k);
+        std::partial_sort(top.begin(), top.begin() + num_top, top.end(), cmpf);
+        top.resize(num_top);
+
+        perf_phase(&pp, "merge");
+        phase.stop();
+        elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
+        avg_elt += elt;
+        fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, num_strings);
+
+    }
+
+    avg_elt = avg_elt/num_iterations;
+
+    /* error bounds */
+    double hll_std_err = 1.04 / sqrt((double) HLL_M);
+    double cm_eps = exp(1.0) / CM_WIDTH;
+    double cm_delta = exp(-(double) CM_DEPTH);
+    fprintf(stderr, "Estimated unique strings: %.0lf (+/- %.2lf%% std. error)\n",
+            est_uniq, 100.0 * hll_std_err);
+    fprintf(stderr, "Top %d estimates overcount by at most %.0lf with probability %.4lf\n",
+            (int) top.size(), cm_eps * num_strings, 1.0 - cm_delta);
+    fprintf(stderr, "Strings without a SpaceSaving counter occur at most %lld times\n",
+            (long long) sketches[0]->ss_floor);
+
+    /* validate against the exact counts */
+    compare_str_cmpf str_cmpf;
+    std::sort(B, B+num_strings, str_cmpf);
+    int64_t *counts = (int64_t *) alloc_array(num_strings, sizeof(int64_t));
+    int64_t num_uniq_strings = kamesh_find_uniq(B, num_strings, counts);
+    fprintf(stderr, "Exact unique strings: %lld (error %.2lf%%)\n", (long long) num_uniq_strings,
+            100.0 * (est_uniq - num_uniq_strings) / num_uniq_strings);
+
+    size_t k;
+    for (k=0; k<top.size(); k++) {
+        char *key = (char *) top[k].second;
+        char **last = std::upper_bound(B, B+num_strings, key, str_cmpf);
+        int64_t exact = counts[last - B - 1];
+        fprintf(stderr, "%s\t%llu\t(exact %lld)\n", top[k].second,
+                (unsigned long long) top[k].first, (long long) exact);
+    }
+
+    for (t=0; t<num_threads; t++)
+        delete sketches[t];
+    delete [] sketches;
+    free(B);
+    free(counts);
+
+    perf_summary(&pp, num_strings);
+    bench_report("sketch", num_strings, str_array_size, times, num_iterations);
+    free(times);
+
+    fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
+    fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", str_array_size/(avg_elt*1e6));
+
+    return 0;
+
+}
+
+/* ------------------------------------------------------------------------
+ * Hash aggregation: open addressing (linear probing) table of
+ * (string, count), grown by doubling so its size follows the number of
+ * unique strings rather than the number of lines.
+ * ------------------------------------------------------------------------ */
+
+struct str_count {
+    const char *str;
+    uint64_t hash;
+    int64_t count;
+};
+
+struct str_count_table {
+    str_count *slots;
+    int64_t capacity;   /* power of two */
+    int64_t size;
+};
+
+static void str_table_init(str_count_table *t, int64_t capacity) {
+    t->capacity = 16;
+    while (t->capacity < capacity)
+        t->capacity *= 2;
+    t->slots = (str_count *) calloc(t->capacity, sizeof(str_count));
+    assert(t->slots != NULL);
+    t->size = 0;
+}
+
+static void str_table_free(str_count_table *t) {
+    free(t->slots);
+    t->slots = NULL;
+    t->capacity = t->size = 0;
+}
+
+/* empties t but keeps its capacity, so a table reused across iterations
+   stops growing once it has seen the input */
+static void str_table_clear(str_count_table *t) {
+    sort_ctx_zero(t->slots, t->capacity * sizeof(str_count));
+    t->size = 0;
+}
+
+static void str_table_add(str_count_table *t, const char *str, uint64_t hash, int64_t count);
+
+static void str_table_grow(str_count_table *t) {
+    str_count *old_slots = t->slots;
+    int64_t old_capacity = t->capacity;
+    str_table_init(t, 2 * old_capacity);
+    int64_t i;
+    for (i=0; i<old_capacity; i++) {
+        if (old_slots[i].str != NULL)
+            str_table_add(t, old_slots[i].str, old_slots[i].hash, old_slots[i].count);
+    }
+    free(old_slots);
+}
+
+static void str_table_add(str_count_table *t, const char *str, uint64_t hash, int64_t count) {
+    if (2 * (t->size + 1) > t->capacity)
+        str_table_grow(t);
+    int64_t mask = t->capacity - 1;
+    int64_t i = (int64_t) (hash & mask);
+    for (;;) {
+        str_count *slot = &t->slots[i];
+        if (slot->str == NULL) {
+            slot->str = str;
+            slot->hash = hash;
+            slot->count = count;
+            t->size++;
+            return;
+        }
+        if (slot->hash == hash && str_equal(slot->str, str)) {
+            slot->count += count;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+/* largest count first, ties in lexical order */
+class compare_count_cmpf {
+    public:
+        bool operator() (const str_count &u, const str_count &v) {
+            if (u.count != v.count)
+                return u.count > v.count;
+            return str_cmp(u.str, v.str) < 0;
+        }
+};
+
+/* checks the top k against the table they came from: in order, and no
+   sampled string ahead of the first.  Full mode also checks that the counts
+   add up to the input and that exactly the top k but the last come before
+   the last. */
+static void verify_top_k(const str_count_table *table, const std::vector<str_count> &top,
+        const int64_t num_strings) {
+    double t0 = verify_begin();
+    const int64_t m = verify_num_checks(table->capacity);
+    compare_count_cmpf cmpf;
+    int64_t k, errors = 0, total_strings = 0, ahead = 0, occupied = 0;
+    for (k=1; k<(int64_t) top.size(); k++)
+        errors += !cmpf(top[k-1], top[k]);
+    for (k=0; k<m && !top.empty(); k++) {
+        const str_count &slot = table->slots[verify_index(k, table->capacity)];
+        if (slot.str == NULL)
+            continue;
+        occupied++;
+        total_strings += slot.count;
+        errors += cmpf(slot, top[0]);
+        ahead += cmpf(slot, top.back());
+    }
+    if (verify.mode == VERIFY_FULL) {
+        errors += (total_strings != num_strings);
+        errors += (occupied != table->size);
+        errors += !top.empty() && (ahead != (int64_t) top.size() - 1);
+    }
+    verify_end(t0, errors, "top_k");
+}
+
+int find_uniq_top_k(char *str_array, const int64_t str_array_size,
+        const int64_t num_strings, const int num_iterations, const int top_k) {
+
+    fprintf(stderr, "N %lld\n", (long long) num_strings);
+    fprintf(stderr, "Using hash aggregation + top %d selection\n", top_k);
+    fprintf(stderr, "Execution times (ms) for %d iterations:\n", num_iterations);
+
+    int iter;
+    double avg_elt;
+
+    /* the input is tokenized once; the table keeps the capacity it grew
+       to during the warm-up iterations */
+    char **B;
+    B = (char **) alloc_array(num_strings, sizeof(char *));
+    tokenize_lines(str_array, str_array_size, num_strings, B);
+
+    str_count_table table;
+    str_table_init(&table, 1024);
+
+    std::vector<str_count> top;
+
+    double *times = (double *) alloc_array(num_iterations, sizeof(double));
+
+    perf_phases pp;
+    perf_phases_init(&pp);
+
+    avg_elt = 0.0;
+
+    for (iter = -bench_cfg.num_warmup; iter < num_iterations; iter++) {
+        
+        int64_t i;
+
+        scoped_phase phase(PHASE_TOKENIZE);
+
+        str_table_clear(&table);
+
+        double elt;
+        elt = timer();
+        perf_begin(&pp);
+        phase.next(PHASE_COUNT);
+
+        for (i=0; i<num_strings; i++)
+            str_table_add(&table, B[i], str_hash64(B[i]), 1);
+
+        perf_phase(&pp, "aggregate");
+        phase.next(PHASE_SORT);
+        /* compact the occupied slots, then select the k largest */
+        top.clear();
+        top.reserve(table.size);
+        int64_t s;
+        for (s=0; s<table.capacity; s++) {
+            if (table.slots[s].str != NULL)
+                top.push_back(table.slots[s]);
+        }
+        int64_t num_uniq_strings = table.size;
+
+        compare_count_cmpf cmpf;
+        int num_top = (int) std::min((int64_t) top_k, num_uniq_strings);
+        if (num_top < num_uniq_strings)
+            std::nth_element(top.begin(), top.begin() + num_top, top.end(), cmpf);
+
+        top.resize(num_top);
+        std::sort(top.begin(), top.end(), cmpf);
+
+        perf_phase(&pp, "select");
+        phase.stop();
+        elt = timer() - elt;
+        if (iter < 0)
+            continue;   /* warm-up run */
+        times[iter] = elt;
+        avg_elt += elt;
+        fprintf(stderr, "%9.3lf\n", elt*1e3);
+        perf_end_iteration(&pp, num_strings);
+
+        /* correctness check, on the table before it is cleared */
+        verify_top_k(&table, top, num_strings);
+
+        if (iter == 0)
+            fprintf(stderr, "Number of unique strings: %lld\n", (long long) num_uniq_strings);
+
+    }
+
+    avg_elt = avg_elt/num_iterations;
+
+    scoped_phase phase(PHASE_OUTPUT);
+    size_t k;
+    for (k=0; k<top.size(); k++)
+        fprintf(stderr, "%s\t%lld\n", top[k].str, (long long) top[k].count);
+
+    phase.stop();
+    str_table_free(&table);
+    free(B);
+
+    perf_summary(&pp, num_strings);
+    bench_report("top_k", num_strings, str_array_size, times, num_iterations);
+    free(times);
+
+    fprintf(stderr, "Average time: %9.3lf ms.\n", avg_elt*1e3);
+    fprintf(stderr, "Average sort rate: %6.3lf MB/s\n", str_array_size/(avg_elt*1e6));
+
+    return 0;
+
+}
+
+/* ------------------------------------------------------------------------
+ * Incremental counting.
+ *
+ * The aggregate over all previous batches is kept on disk as one sorted
+ * run of (string, count) records, in the same format as the external sort
+ * runs.  A new batch is sorted and collapsed in memory, then merged with the
+ * saved state in one sequential pass; old strings are never re-sorted.  The
+ * new state is written next to the old one and renamed over it, so an
+ * interrupted update leaves the previous checkpoint intact.
+ * ------------------------------------------------------------------------ */
+
+/* the next record of the saved state; a state that is out of order, has
+   duplicates or a count below 1 is damaged, and replacing it would lose
+   history */
+static int state_next(ext_run_reader *r) {
+    if (!ext_run_next(r))
+        return 0;
+    if (r->count < 1 || (r->records > 1 && str_cmp(r->prev, r->str) >= 0)) {
+        fprintf(stderr, "Error: %s is damaged: record %lld is %s!\n", r->name,
+                (long long) r->records, (r->count < 1) ? "not counted" : "out of order");
+        exit(2);
+    }
+    return 1;
+}
+
+int find_uniq_incremental(char *str_array, const int64_t str_array_size,
+        const int64_t num_strings, const char *state_file) {
+
+    fprintf(stderr, "N %lld\n", (long long) num_strings);
+    fprintf(stderr, "Using incremental merge into state file %s\n", state_file);
+
+    char **B;
+    B = (char **) alloc_array(num_strings, sizeof(char *));
+
+    int64_t i;
+
+    scoped_phase phase(PHASE_TOKENIZE);
+
+    tokenize_lines(str_array, str_array_size, num_strings, B);
+
+    double elt, batch_elt;
+    elt = timer();
+    phase.next(PHASE_SORT);
+
+    /* sort and count the new batch */
+    compare_str_cmpf cmpf;
+    std::sort(B, B+num_strings, cmpf);
+    phase.next(PHASE_COUNT);
+
+    int64_t *counts;
+    counts = (int64_t *) alloc_array(num_strings, sizeof(int64_t));
+    /* kamesh_find_uniq() only sets the last count of every run; the merge
+       below finds the run ends by the zeros in front of them */
+    sort_ctx_zero(counts, num_strings * sizeof(int64_t));
+    int64_t batch_uniq_strings = kamesh_find_uniq(B, num_strings, counts);
+
+    batch_elt = timer() - elt;
+    phase.next(PHASE_OUTPUT);
+
+    /* merge with the previous state */
+    ext_run_reader old_state;
+    memset(&old_state, 0, sizeof(old_state));
+    old_state.fp = fopen(state_file, "rb");
+    old_state.name = state_file;
+    /* only a missing file is an empty state; replacing one we couldn't
+       read would drop its counts */
+    if (old_state.fp == NULL && errno != ENOENT) {
+        fprintf(stderr, "Error: Couldn't open %s: %s!\n", state_file, strerror(errno));
+        exit(2);
+    }
+    int have_old = (old_state.fp != NULL) && state_next(&old_state);
+
+    char tmp_file[4096];
+    snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", state_file);
+    FILE *out = fopen(tmp_file, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Error: Couldn't create state file!\n");
+        exit(2);
+    }
+
+    int64_t num_uniq_strings = 0;
+    int64_t total_strings = 0;
+    int64_t old_total_strings = 0;
+    i = 0;
+    while (have_old || i < num_strings) {
+        /* skip to the last copy of the next batch string; it holds the count */
+        int cmpval;
+        if (!have_old)
+            cmpval = 1;
+        else if (i >= num_strings)
+            cmpval = -1;
+        else
+            cmpval = str_cmp(old_state.str, B[i]);
+
+        if (cmpval < 0) {
+            ext_write_record(out, old_state.str, old_state.len, old_state.count);
+            total_strings += old_state.count;
+            old_total_strings += old_state.count;
+            have_old = state_next(&old_state);
+        } else {
+            int64_t last = i;
+            while (counts[last] == 0)
+                last++;
+            int64_t count = counts[last];
+            if (cmpval == 0) {
+                count += old_state.count;
+                old_total_strings += old_state.count;
+                have_old = state_next(&old_state);
+            }
+            ext_write_record(out, B[i], (uint32_t) strlen(B[i]), count);
+            total_strings += count;
+            i = last + 1;
+        }
+        num_uniq_strings++;
+    }
+
+    if (old_state.fp != NULL)
+        fclose(old_state.fp);
+    free(old_state.str);
+    free(old_state.prev);
+
+    /* checkpoint: flush to disk, then atomically replace the old state */
+    if (fflush(out) != 0 || fsync(fileno(out)) != 0 || fclose(out) != 0 ||
+            rename(tmp_file, state_file) != 0) {
+        fprintf(stderr, "Error: Couldn't write state file!\n");
+        exit(2);
+    }
+
+    elt = timer() - elt;
+    phase.stop();
+
+    /* a complete correctness check on the totals */
+    assert(total_strings == old_total_strings + num_strings);
+
+    fprintf(stderr, "Batch unique strings: %lld\n", (long long) batch_uniq_strings);
+    fprintf(stderr, "Number of unique strings: %lld (%lld strings in total)\n",
+            (long long) num_uniq_strings, (long long) total_strings);
+    fprintf(stderr, "Batch sort + count: %9.3lf ms.\n", batch_elt*1e3);
+    bench_report("incremental", num_strings, str_array_size, &elt, 1);
+    fprintf(stderr, "Time: %9.3lf ms.\n", elt*1e3);
+
+    free(B);
+    free(counts);
+
+    return 0;
+
+}
+
+/* ------------------------------------------------------------------------
+ * Multi-file merge of pre-sorted inputs.
+ *
+ * Every shard is read sequentially.  Advancing a shard compares the new line
+ * with the previous one, which yields both the lcp the loser tree needs and a
+ * sortedness check.  If a shard turns out not to be sorted, it is sorted into
+ * a temporary file and the merge starts over; the sorted shards are never
+ * loaded or sorted.
+ * ------------------------------------------------------------------------ */
+
+struct shard_reader {
+    FILE *fp;
+    char *str;          /* current line, '\n' stripped */
+    size_t str_cap;
+    char *prev;         /* previous line of this shard */
+    size_t prev_cap;
+    int lcp;
+    int done;
+    int unsorted;       /* set when a line is smaller than its predecessor */
+    int64_t lines;
+};
+
+static void shard_next(shard_reader *r) {
+    char *tmp = r->prev;
+    size_t tmp_cap = r->prev_cap;
+    r->prev = r->str;
+    r->prev_cap = r->str_cap;
+    r->str = tmp;
+    r->str_cap = tmp_cap;
+
+    ssize_t len = getline(&r->str, &r->str_cap, r->fp);
+    if (len < 0) {
+        r->done = 1;
+        return;
+    }
+    if (len > 0 && r->str[len-1] == '\n')
+        r->str[len-1] = '\0';
+    r->lines++;
+
+    if (r->lines == 1) {
+        r->lcp = 0;
+        return;
+    }
+    const unsigned char *s = (const unsigned char *) r->str;
+    const unsigned char *p = (const unsigned char *) r->prev;
+    int l = 0;
+    while (s[l] != '\0' && s[l] == p[l])
+        l++;
+    if (s[l] < p[l])
+        r->unsorted = 1;
+    r->lcp = l;
+}
+
+/* read a whole shard, sort it and return it as a temporary sorted file */
+static FILE *shard_sort(FILE *fp) {
+    rewind(fp);
+    std::vector<char *> lines;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, fp)) >= 0) {
+        if (len > 0 && line[len-1] == '\n')
+            line[len-1] = '\0';
+        lines.push_back(strdup(line));
+    }
+    free(line);
+    fclose(fp);
+
+    compare_str_cmpf cmpf;
+    std::sort(lines.begin(), lines.end(), cmpf);
+
+    FILE *out = tmpfile();
+    if (out == NULL) {
+        fprintf(stderr, "Error: Couldn't create temporary file!\n");
+        exit(2);
+    }
+    size_t i;
+    for (i=0; i<lines.size(); i++) {
+        fputs(lines[i], out);
+        fputc('\n', out);
+        free(lines[i]);
+    }
+    rewind(out);
+    return out;
+}
+
+int find_uniq_multiway_merge(char **filenames, const int num_files,
+        const int64_t total_size_bytes, const int64_t num_strings) {
+
+    fprintf(stderr, "N %lld\n", (long long) num_strings);
+    fprintf(stderr, "Using %d-way merge of sorted files\n", num_files);
+
+    shard_reader *shards = (shard_reader *) calloc(num_files, sizeof(shard_reader));
+    assert(shards != NULL);
+
+    int i;
+    for (i=0; i<num_files; i++) {
+        shards[i].fp = fopen(filenames[i], "r");
+        if (shards[i].fp == NULL) {
+            fprintf(stderr, "Error: Couldn't open file %s!\n", filenames[i]);
+            exit(2);
+        }
+    }
+
+    int num_resorted = 0;
+    int64_t num_uniq_strings;
+    int64_t total_strings;
+
+    double elt;
+    elt = timer();
+
+    for (;;) {
+        for (i=0; i<num_files; i++) {
+            rewind(shards[i].fp);
+            shards[i].done = 0;
+            shards[i].lines = 0;
+            shards[i].unsorted = 0;
+            shard_next(&shards[i]);
+        }
+
+        lcp_loser_tree<shard_reader> tree;
+        lcp_tree_init(&tree, shards, num_files);
+
+        num_uniq_strings = 0;
+        total_strings = 0;
+        int prev_len = -1;
+        int bad_shard = -1;
+        int w;
+        while ((w = lcp_tree_top(&tree)) >= 0) {
+            shard_reader *r = &shards[w];
+            /* equal to the previous output iff it matches it completely */
+            if (!(r->lcp == prev_len && r->str[prev_len] == '\0')) {
+                num_uniq_strings++;
+                prev_len = r->lcp + (int) strlen(r->str + r->lcp);
+            }
+            total_strings++;
+
+            shard_next(r);
+            if (r->unsorted) {
+                bad_shard = w;
+                break;
+            }
+            lcp_tree_replay(&tree);
+        }
+        lcp_tree_free(&tree);
+
+        if (bad_shard < 0)
+            break;
+
+        fprintf(stderr, "%s is not sorted (line %lld), sorting it\n",
+                filenames[bad_shard], (long long) shards[bad_shard].lines);
+        shards[bad_shard].fp = shard_sort(shards[bad_shard].fp);
+        num_resorted++;
+    }
+
+    elt = timer() - elt;
+
+    for (i=0; i<num_files; i++) {
+        fclose(shards[i].fp);
+        free(shards[i].str);
+        free(shards[i].prev);
+    }
+    free(shards);
+
+    fprintf(stderr, "num strings read %lld\n", (long long) total_strings);
+    assert(num_strings == total_strings);
+
+    fprintf(stderr, "Shards sorted on fallback: %d\n", num_resorted);
+    fprintf(stderr, "Number of unique strings: %lld\n", (long long) num_uniq_strings);
+    bench_report("multiway_merge", num_strings, total_size_bytes, &elt, 1);
+    fprintf(stderr, "Time: %9.3lf ms.\n", elt*1e3);
+    fprintf(stderr, "Sort rate: %6.3lf MB/s\n", total_size_bytes/(elt*1e6));
+
+    return 0;
+
+}
+
+/* writes num_strings generated lines (see gen.h) to filename; blocks of
+   lines are generated in parallel and written in order */
+static void gen_str_file(const char *filename, int kind, const int64_t num_strings) {
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Couldn't create %s!\n", filename);
+        exit(2);
+    }
+
+    gen_zipf_table z;
+    gen_zipf_init(&z, (num_strings < GEN_ZIPF_VOCAB) ? num_strings : GEN_ZIPF_VOCAB);
+
+    const int64_t block = 1 << 16;
+    const int64_t stride = GEN_STR_MAX + 2;
+    char *buf = (char *) alloc_array(block, stride);
+    int *len = (int *) alloc_array(block, sizeof(int));
+    int64_t lo, i;
+    for (lo=0; lo<num_strings; lo+=block) {
+        int64_t hi = (lo + block < num_strings) ? lo + block : num_strings;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (i=lo; i<hi; i++)
+            len[i-lo] = gen_str_line(kind, &z, num_strings, i, &buf[(i-lo) * stride]);
+        for (i=lo; i<hi; i++) {
+            char *line = &buf[(i-lo) * stride];
+            line[len[i-lo]] = '\n';
+            fwrite(line, 1, len[i-lo] + 1, fp);
+        }
+    }
+
+    free(len);
+    free(buf);
+    gen_zipf_free(&z);
+    fclose(fp);
+}
+
+/* the in-memory benchmarks, by alg_type */
+static int uniq_alg(int alg_type, char *str_array, const int64_t str_array_size,
+        const int64_t num_strings, const int num_iterations, const int top_k) {
+    if (alg_type == 0)
+        return find_uniq_qsort(str_array, str_array_size, num_strings, num_iterations);
+    if (alg_type == 1)
+        return find_uniq_inline_qsort(str_array, str_array_size, num_strings, num_iterations);
+    if (alg_type == 2)
+        return find_uniq_stl_sort(str_array, str_array_size, num_strings, num_iterations);
+    if (alg_type == 3)
+        return find_uniq_stl_map(str_array, str_array_size, num_strings, num_iterations);
+    if (alg_type == 5)
+        return find_uniq_sketch(str_array, str_array_size, num_strings, num_iterations, top_k);
+    if (alg_type == 6)
+        return find_uniq_top_k(str_array, str_array_size, num_strings, num_iterations, top_k);
+    return find_uniq_stable(str_array, str_array_size, num_strings, num_iterations);
+}
+
+/* ------------------------------------------------------------------------
+ * Automatic choice of the algorithm ("best" as alg_type, see tune.h).
+ *
+ * UNIQ_SAMPLE strings, found from random byte offsets, put the input in
+ * one class: sorted (few neighbours out of order), many duplicates, long
+ * common prefixes (between neighbours of the sorted sample), or none of
+ * these.  Each class has its own winner among the exact counters 0-3 and
+ * 6 (hash aggregation); a tuning run times them on generated inputs of
+ * every class: sorted varlen, zipf, iri and varlen lines.
+ * ------------------------------------------------------------------------ */
+
+#define UNIQ_SAMPLE         2048
+
+#define UNIQ_CLASS_SORTED   0
+#define UNIQ_CLASS_DUPS     1
+#define UNIQ_CLASS_PREFIX   2
+#define UNIQ_CLASS_OTHER    3
+#define UNIQ_NUM_CLASSES    4
+
+static const char *uniq_class_names[UNIQ_NUM_CLASSES] = {
+    "sorted", "dups", "prefix", "other"
+};
+
+/* the tuning parameter naming each class's winner, and its default */
+static const char *uniq_class_params[UNIQ_NUM_CLASSES] = {
+    "alg_sorted", "alg_dups", "alg_prefix", "alg_other"
+};
+static const int uniq_class_default[UNIQ_NUM_CLASSES] = { 0, 6, 1, 1 };
+
+static const int uniq_candidates[] = { 0, 1, 2, 3, 6 };
+#define UNIQ_NUM_CANDIDATES ((int) (sizeof(uniq_candidates) / sizeof(uniq_candidates[0])))
+
+struct uniq_stats {
+    double descents;    /* fraction of sampled neighbours out of order */
+    double dups;        /* 1 - distinct / sampled strings */
+    double avg_len;
+    double avg_lcp;     /* common prefix of neighbours in the sorted sample */
+};
+
+static uniq_stats uniq_sample_stats(const char *str_array, const int64_t str_array_size) {
+    uniq_stats st;
+    std::vector<const char *> sample;
+    const uint64_t seed = gen_seed ^ 0x73616d70ULL;
+    int64_t k, down = 0, pairs = 0, total_len = 0;
+
+    for (k=0; k<UNIQ_SAMPLE; k++) {
+        int64_t i = (int64_t) (gen_u64(seed, k) % (uint64_t) str_array_size);
+        while (i > 0 && str_array[i-1] != '\0')
+            i--;
+        const char *s = &str_array[i];
+        int64_t len = strlen(s);
+        sample.push_back(s);
+        total_len += len;
+        if (i + len + 1 < str_array_size) {
+            down += (str_cmp(s, s + len + 1) > 0);
+            pairs++;
+        }
+    }
+    st.descents = (pairs > 0) ? (double) down / pairs : 0.0;
+    st.avg_len = (double) total_len / UNIQ_SAMPLE;
+
+    std::sort(sample.begin(), sample.end(),
+            [](const char *u, const char *v) { return str_cmp(u, v) < 0; });
+    int64_t distinct = 1, total_lcp = 0;
+    for (k=1; k<UNIQ_SAMPLE; k++) {
+        const char *u = sample[k-1], *v = sample[k];
+        int64_t l = 0;
+        while (u[l] != '\0' && u[l] == v[l])
+            l++;
+        if (u[l] != v[l]) {
+            distinct++;
+            total_lcp += l;
+        }
+    }
+    st.dups = 1.0 - (double) distinct / UNIQ_SAMPLE;
+    st.avg_lcp = (distinct > 1) ? (double) total_lcp / (distinct - 1) : 0.0;
+    return st;
+}
+
+static int uniq_classify(const uniq_stats *st) {
+    if (st->descents <= tune_get("presorted_max", 0.05))
+        return UNIQ_CLASS_SORTED;
+    if (st->dups >= tune_get("dup_min", 0.25))
+        return UNIQ_CLASS_DUPS;
+    if (st->avg_lcp >= tune_get("lcp_min", 16))
+        return UNIQ_CLASS_PREFIX;
+    return UNIQ_CLASS_OTHER;
+}
+
+static int uniq_best_alg(const char *str_array, const int64_t str_array_size) {
+    if (tune_load() != 0)
+        fprintf(stderr, "No tuning file %s, using defaults (run with alg_type tune)\n", tune.path);
+    double elt = timer();
+    uniq_stats st = uniq_sample_stats(str_array, str_array_size);
+    int c = uniq_classify(&st);
+    int alg = (int) tune_get(uniq_class_params[c], uniq_class_default[c]);
+    /* uniq_alg() runs anything else as the stable sort */
+    int a;
+    for (a=0; a<UNIQ_NUM_CANDIDATES && uniq_candidates[a] != alg; a++)
+        ;
+    if (a == UNIQ_NUM_CANDIDATES) {
+        fprintf(stderr, "Ignoring %s = %d in %s: not one of the tuned alg_types\n",
+                uniq_class_params[c], alg, tune.path);
+        alg = uniq_class_default[c];
+    }
+    elt = timer() - elt;
+    fprintf(stderr, "Input sample: %.3lf out of order, %.3lf duplicates, "
+            "length %.1lf, common prefix %.1lf\n", st.descents, st.dups, st.avg_len, st.avg_lcp);
+    fprintf(stderr, "Input class %s: using alg_type %d (chosen in %.3lf ms)\n",
+            uniq_class_names[c], alg, elt*1e3);
+    return alg;
+}
+
+/* num_strings generated lines in memory, '\0' terminated, optionally sorted */
+static char *uniq_gen_input(int kind, const int64_t num_strings, int sorted, int64_t *size) {
+    gen_zipf_table z;
+    gen_zipf_init(&z, (num_strings < GEN_ZIPF_VOCAB) ? num_strings : GEN_ZIPF_VOCAB);
+    std::vector<std::string> lines(num_strings);
+    char line[GEN_STR_MAX + 1];
+    int64_t i;
+    *size = 0;
+    for (i=0; i<num_strings; i++) {
+        int len = gen_str_line(kind, &z, num_strings, i, line);
+        lines[i].assign(line, len);
+        *size += len + 1;
+    }
+    gen_zipf_free(&z);
+    if (sorted)
+        std::sort(lines.begin(), lines.end());
+
+    char *str_array = (char *) numa_alloc_array(*size, sizeof(char));
+    char *p = str_array;
+    for (i=0; i<num_strings; i++) {
+        memcpy(p, lines[i].c_str(), lines[i].size() + 1);
+        p += lines[i].size() + 1;
+    }
+    return str_array;
+}
+
+static void uniq_tune(const int64_t num_strings, const int top_k) {
+    static const int class_kind[UNIQ_NUM_CLASSES] = {
+        GEN_STR_VARLEN, GEN_STR_ZIPF, GEN_STR_IRI, GEN_STR_VARLEN
+    };
+    int saved_format = bench_cfg.format;
+    int saved_verify = verify.mode;
+    bench_cfg.format = BENCH_FORMAT_NONE;
+    verify.mode = VERIFY_OFF;
+    tune_load();
+
+    fprintf(stderr, "Tuning on %lld generated lines, median ms per alg_type:\n",
+            (long long) num_strings);
+    int c, a;
+    for (c=0; c<UNIQ_NUM_CLASSES; c++) {
+        int64_t size;
+        char *str_array = uniq_gen_input(class_kind[c], num_strings, c == UNIQ_CLASS_SORTED, &size);
+        double best_ms = -1.0;
+        int winner = uniq_candidates[0];
+        fprintf(stderr, "%-7s", uniq_class_names[c]);
+        for (a=0; a<UNIQ_NUM_CANDIDATES; a++) {
+            tune_quiet(1);
+            uniq_alg(uniq_candidates[a], str_array, size, num_strings, 3, top_k);
+            tune_quiet(0);
+            double ms = bench_last_median * 1e3;
+            fprintf(stderr, " %d:%.3lf", uniq_candidates[a], ms);
+            if (best_ms < 0.0 || ms < best_ms) {
+                best_ms = ms;
+                winner = uniq_candidates[a];
+            }
+        }
+        fprintf(stderr, " -> %d\n", winner);
+        tune_set(uniq_class_params[c], winner);
+        numa_free(str_array);
+    }
+    tune_get("presorted_max", 0.05);
+    tune_get("dup_min", 0.25);
+    tune_get("lcp_min", 16);
+
+    if (tune_save("uniq_str") == 0)
+        fprintf(stderr, "Tuning parameters written to %s\n", tune.path);
+    bench_cfg.format = saved_format;
+    verify.mode = saved_verify;
+}
+
+int main(int argc, char **argv) {
+
+    int64_t mem_limit = ((int64_t) 1024) << 20;
+    const char *tmp_dir = NULL;
+    int top_k = 10;
+    const char *state_file = NULL;
+    int num_iterations = 10;
+
+    int num_threads = 0;
+    pool_affinity affinity = pool_parse_affinity("none");
+    int numa_policy = NUMA_DEFAULT;
+    int gen_kind = -1;
+    const char *tune_file = NULL;
+    const char *query_file = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:t:k:s:i:w:f:pT:a:N:H:V:g:S:C:q:")) != -1) {
+        if (opt == 'm') {
+            mem_limit = ((int64_t) atoll(optarg)) << 20;
+        } else if (opt == 't') {
+            tmp_dir = optarg;
+        } else if (opt == 'k') {
+            top_k = atoi(optarg);
+        } else if (opt == 's') {
+            state_file = optarg;
+        } else if (opt == 'i') {
+            num_iterations = atoi(optarg);
+        } else if (opt == 'w') {
+            bench_cfg.num_warmup = atoi(optarg);
+        } else if (opt == 'f') {
+            bench_cfg.format = bench_parse_format(optarg);
+        } else if (opt == 'p') {
+            perf_open();
+        } else if (opt == 'T') {
+            num_threads = atoi(optarg);
+        } else if (opt == 'a') {
+            affinity = pool_parse_affinity(optarg);
+        } else if (opt == 'N') {
+            numa_policy = numa_parse_policy(optarg);
+        } else if (opt == 'H') {
+            huge.mode = huge_parse_mode(optarg);
+        } else if (opt == 'V') {
+            verify.mode = verify_parse_mode(optarg);
+        } else if (opt == 'g') {
+            gen_kind = gen_str_parse_kind(optarg);
+        } else if (opt == 'S') {
+            gen_seed = strtoull(optarg, NULL, 0);
+        } else if (opt == 'C') {
+            tune_file = optarg;
+        } else if (opt == 'q') {
+            query_file = optarg;
+        } else {
+            argc = 0;   /* print usage */
+        }
+    }
+
+    if (argc - optind < 3) {
+        fprintf(stderr, "%s [options] <input file> <n> <alg_type> [input files...]\n", argv[0]);
+        fprintf(stderr, "alg_type 0: use C qsort, then find unique strings\n");
+        fprintf(stderr, "         1: use inline qsort, then find unique strings\n");
+        fprintf(stderr, "         2: use STL sort, then find unique strings\n");
+        fprintf(stderr, "         3: use STL map\n");
+        fprintf(stderr, "         4: external sort + merge with bounded memory\n");
+        fprintf(stderr, "         5: approximate count and top-k with sketches\n");
+        fprintf(stderr, "         6: hash aggregation, then exact top-k\n");
+        fprintf(stderr, "         7: merge counts into a saved state (needs -s)\n");
+        fprintf(stderr, "         8: k-way merge of sorted input files, n lines in total\n");
+        fprintf(stderr, "         9: stable sort, with the first line of every unique string\n");
+        fprintf(stderr, "        10: sorted index, built once, answering the queries of -q\n");
+        fprintf(stderr, "         best: pick 0-3 or 6 from a sample of the input and the tuning file\n");
+        fprintf(stderr, "         tune: time 0-3 and 6 on n generated lines of every class, write\n");
+        fprintf(stderr, "               the tuning file (the input file is not read)\n");
+        fprintf(stderr, "options -m <MB>:  memory limit for alg_type 4 (default 1024)\n");
+        fprintf(stderr, "        -t <dir>: directory for alg_type 4 runs (default tmpfile())\n");
+        fprintf(stderr, "        -k <k>:   number of most frequent strings for alg_type 5, 6 (default 10)\n");
+        fprintf(stderr, "        -s <file>: state file updated by alg_type 7\n");
+        fprintf(stderr, "        -i <n>:    timed iterations (default 10)\n");
+        fprintf(stderr, "        -w <n>:    untimed warm-up iterations (default 1)\n");
+        fprintf(stderr, "        -f csv|json: print results in a machine readable format\n");
+        fprintf(stderr, "        -p:        report hardware performance counters\n");
+        fprintf(stderr, "        -T <n>:    worker threads (default OMP_NUM_THREADS)\n");
+        fprintf(stderr, "        -a none|compact|scatter|node<N>: pin worker threads (default none)\n");
+        fprintf(stderr, "        -N default|firsttouch|interleave: NUMA placement of the input and scratch\n");
+        fprintf(stderr, "        -H off|thp|hugetlb: huge pages for the input and scratch (default thp)\n");
+        fprintf(stderr, "        -V full|sample[<n>]|off: check results after every iteration (default full)\n");
+        fprintf(stderr, "        -g zipf|iri|varlen: first write n generated lines to <input file>\n");
+        fprintf(stderr, "        -S <seed>: seed for -g (default 123)\n");
+        fprintf(stderr, "        -C <file>: tuning file for best and tune (default uniq_str.tune)\n");
+        fprintf(stderr, "        -q <file>: queries for alg_type 10, one per line: <string> or =<string>\n");
+        fprintf(stderr, "                   (exact match), ^<prefix> (prefix range); by default every\n");
+        fprintf(stderr, "                   input line, odd lines as a prefix range of their first half\n");
+        exit(1);
+    }
+
+    str_simd_init();
+    fprintf(stderr, "String compare kernel: %s\n", str_simd_name);
+
+    /* after perf_open(): the counters follow threads created from here on */
+    pool_init(num_threads, affinity);
+    numa_init(numa_policy);
+
+    char *filename = argv[optind];
+    bench_cfg.program = "uniq_str";
+    bench_cfg.input = filename;
     
-    int num_strings;
-    num_strings = atoi(argv[2]);
+    int64_t num_strings;
+    num_strings = atoll(argv[optind+1]);
+
+    int alg_type = atoi(argv[optind+2]);
+    assert((alg_type >= 0) && (alg_type <= 10));
+    assert((argc - optind == 3) || (alg_type == 8));
+
+    tune_set_path(bench_cfg.program, tune_file);
+    if (strcmp(argv[optind+2], "tune") == 0) {
+        assert(num_strings > 0);
+        uniq_tune(num_strings, top_k);
+        phase_report();
+        return 0;
+    }
+
+    if (gen_kind >= 0) {
+        double elt = timer();
+        gen_str_file(filename, gen_kind, num_strings);
+        fprintf(stderr, "Generated %lld lines in %9.3lf ms\n", (long long) num_strings,
+                (timer() - elt)*1e3);
+    }
 
     /* get file size */
     struct stat file_stat;
     stat(filename, &file_stat);
-    int file_size_bytes = file_stat.st_size;
-    fprintf(stderr, "File size: %d bytes\n", file_size_bytes);
+    int64_t file_size_bytes = file_stat.st_size;
+    fprintf(stderr, "File size: %lld bytes\n", (long long) file_size_bytes);
+
+    /* the merge of sorted files streams every file itself */
+    if (alg_type == 8) {
+        char **filenames = (char **) alloc_array(argc - optind - 2, sizeof(char *));
+        int num_files = 0;
+        int64_t total_size_bytes = 0;
+        int a;
+        for (a=optind; a<argc; a++) {
+            if (a == optind+1 || a == optind+2)
+                continue;
+            if (stat(argv[a], &file_stat) == 0)
+                total_size_bytes += file_stat.st_size;
+            filenames[num_files++] = argv[a];
+        }
+        find_uniq_multiway_merge(filenames, num_files, total_size_bytes, num_strings);
+        free(filenames);
+        return 0;
+    }
+
+    /* the external algorithm streams the file itself */
+    if (alg_type == 4) {
+        assert(mem_limit > 0);
+        find_uniq_external(filename, file_stat.st_size, num_strings, mem_limit, tmp_dir);
+        return 0;
+    }
 
     /* load all strings from file */
+    scoped_phase phase(PHASE_LOAD);
     FILE *infp;
     infp = fopen(filename, "r");
     if (infp == NULL) {
@@ -701,38 +3649,55 @@ int main(int argc, char **argv) {
         exit(2);
     }
     
-    char *str_array = (char *) malloc(file_size_bytes * sizeof(char));
+    char *str_array = (char *) numa_alloc_array(file_size_bytes, sizeof(char));
     fread(str_array, sizeof(char), file_size_bytes, infp);
     fclose(infp);
+    numa_report_pages("Input", str_array, file_size_bytes);
+    bench_cfg.pages = huge_page_desc(str_array);
+    fprintf(stderr, "Input pages: %s\n", bench_cfg.pages);
 
     /* replace end of line characters with string delimiters */
-    int i;
-    int num_strings_in_file = 0;
+    int64_t i;
+    int64_t num_strings_in_file = 0;
     for (i=0; i<file_size_bytes; i++) {
         if (str_array[i] == '\n') {
             str_array[i] = '\0';
             num_strings_in_file++;
         }
     }
-    fprintf(stderr, "num strings read %d\n", num_strings_in_file);
+    fprintf(stderr, "num strings read %lld\n", (long long) num_strings_in_file);
     assert(num_strings == num_strings_in_file);
+    phase.stop();
 
-    int alg_type = atoi(argv[3]);
-    assert((alg_type >= 0) && (alg_type <= 3));
-    
-    int num_iterations = 10;
+    /* reference for the multiset checks, charged to verification */
+    if (verify.mode == VERIFY_FULL) {
+        double t0 = verify_begin();
+        verify.input_sum = str_array_checksum(str_array, file_size_bytes);
+        verify_end(t0, 0, "input checksum");
+    }
+
+    assert(num_iterations > 0);
+    assert(bench_cfg.num_warmup >= 0);
 
-    if (alg_type == 0) {
-        find_uniq_qsort(str_array, file_size_bytes, num_strings, num_iterations);
-    } else if (alg_type == 1) {
-        find_uniq_inline_qsort(str_array, file_size_bytes, num_strings, num_iterations);
-    } else if (alg_type == 2) {
-        find_uniq_stl_sort(str_array, file_size_bytes, num_strings, num_iterations);
-    } else if (alg_type == 3) {
-        find_uniq_stl_map(str_array, file_size_bytes, num_strings, num_iterations);
+    if (strcmp(argv[optind+2], "best") == 0)
+        alg_type = uniq_best_alg(str_array, file_size_bytes);
+
+    if (alg_type == 7) {
+        assert(state_file != NULL);
+        find_uniq_incremental(str_array, file_size_bytes, num_strings, state_file);
+    } else if (alg_type == 10) {
+        find_uniq_index(str_array, file_size_bytes, num_strings, num_iterations, query_file);
+    } else {
+        assert(top_k > 0);
+        uniq_alg(alg_type, str_array, file_size_bytes, num_strings, num_iterations, top_k);
     }
 
-    free(str_array);
+    phase_report();
+    verify_report();
+    numa_report();
+
+    numa_free(str_array);
+    arena_free(arena_local());
 
     return 0;
 }
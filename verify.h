@@ -0,0 +1,128 @@
+/* Correctness checks for the benchmarks, kept out of the timed region.
+ *
+ * Every benchmark checks its result after each timed iteration.  With
+ * -V the checks can be scaled down for production-sized runs:
+ *
+ *  full       every element, in parallel: sorted order, a checksum of the
+ *             output multiset against one of the input, and the counts
+ *             (the default)
+ *  sample     only VERIFY_SAMPLES positions, drawn anew for every run, and
+ *             no checksum; "sample<N>" checks N positions
+ *  off        no checks
+ *
+ * A check loops over verify_num_checks(n) positions and maps each to an
+ * element with verify_index(), so the same loop serves both modes:
+ *
+ *  double t0 = verify_begin();
+ *  int64_t k, m = verify_num_checks(n), errors = 0;
+ *  #pragma omp parallel for reduction(+:errors)
+ *  for (k=0; k<m; k++) {
+ *      int64_t i = verify_index(k, n);
+ *      errors += (i > 0 && B[i] < B[i-1]);
+ *  }
+ *  verify_end(t0, errors, "sorted order");
+ *
+ * The multiset checksum is the wrapping sum of verify_mix() of every
+ * element's hash, so it does not depend on the order of the elements.
+ * verify_end() aborts on errors, like the assert()s it replaces, and
+ * charges the time to the checks; verify_report() prints that total.
+ */
+
+#ifndef _VERIFY_H
+#define _VERIFY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "bench.h"
+
+#define VERIFY_OFF      0
+#define VERIFY_SAMPLE   1
+#define VERIFY_FULL     2
+
+#define VERIFY_SAMPLES  4096
+
+static struct {
+    int mode;
+    int64_t samples;        /* positions per sampled check */
+    uint64_t seed;          /* changes with every check, so samples move */
+    uint64_t input_sum;     /* checksum of the input multiset */
+    double time;            /* seconds spent in checks */
+    int64_t runs;
+} verify = { VERIFY_FULL, VERIFY_SAMPLES, 0, 0, 0.0, 0 };
+
+static const char *verify_mode_name(int mode) {
+    static const char *names[] = { "off", "sample", "full" };
+    return names[mode];
+}
+
+static int verify_parse_mode(const char *s) {
+    if (strcmp(s, "off") == 0)
+        return VERIFY_OFF;
+    if (strncmp(s, "sample", 6) == 0) {
+        if (s[6] != '\0')
+            verify.samples = atoll(s + 6);
+        if (verify.samples < 1)
+            verify.samples = 1;
+        return VERIFY_SAMPLE;
+    }
+    if (strcmp(s, "full") != 0)
+        fprintf(stderr, "Unknown verification mode %s, using full\n", s);
+    return VERIFY_FULL;
+}
+
+/* splitmix64 finalizer */
+static inline uint64_t verify_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static inline int64_t verify_num_checks(int64_t n) {
+    if (verify.mode == VERIFY_OFF)
+        return 0;
+    if (verify.mode == VERIFY_SAMPLE && verify.samples < n)
+        return verify.samples;
+    return n;
+}
+
+/* element checked by the k-th of verify_num_checks(n) checks */
+static inline int64_t verify_index(int64_t k, int64_t n) {
+    if (verify.mode == VERIFY_FULL || verify.samples >= n)
+        return k;
+    return (int64_t) (verify_mix(verify.seed + (uint64_t) k) % (uint64_t) n);
+}
+
+static double verify_begin(void) {
+    return timer();
+}
+
+static void verify_end(double t0, int64_t errors, const char *what) {
+    if (verify.mode == VERIFY_OFF)
+        return;
+    verify.time += timer() - t0;
+    verify.runs++;
+    verify.seed = verify_mix(verify.seed + 0x9e3779b97f4a7c15ULL);
+    if (errors != 0) {
+        fprintf(stderr, "Verification failed: %lld errors in %s\n", (long long) errors, what);
+        abort();
+    }
+}
+
+static void verify_report(void) {
+    if (verify.mode == VERIFY_OFF)
+        return;
+    fprintf(stderr, "Verification (%s", verify_mode_name(verify.mode));
+    if (verify.mode == VERIFY_SAMPLE)
+        fprintf(stderr, ", %lld positions", (long long) verify.samples);
+    fprintf(stderr, "): %lld checks, %9.3lf ms total", (long long) verify.runs, verify.time*1e3);
+    if (verify.runs > 0)
+        fprintf(stderr, ", %9.3lf ms per check", verify.time*1e3 / verify.runs);
+    fprintf(stderr, "\n");
+}
+
+#endif /* _VERIFY_H */